@@ -7,6 +7,9 @@
 
 #include "./ray.hpp"
 #include "./vec3.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 
 class AABB {
 public:
@@ -19,7 +22,13 @@ public:
     vec3 min() const { return _min; }
     vec3 max() const { return _max; }
 
+    double surface_area() const {
+        vec3 d = _max - _min;
+        return 2.0 * (d.x() * d.y() + d.x() * d.z() + d.y() * d.z());
+    }
+
     bool hit(const ray &r, double tmin, double tmax) const;
+    bool hit(const traversal_ray &r, float tmin, float tmax) const;
     vec3 _min;
     vec3 _max;
 };
@@ -38,6 +47,48 @@ inline bool AABB::hit(const ray &r, double tmin, double tmax) const {
     return true;
 }
 
+// double 转 float 时向下/向上取整, 避免包围盒缩小
+inline float round_down(double d) {
+    float f = static_cast<float>(d);
+    return f > d ? nextafterf(f, -INFINITY) : f;
+}
+inline float round_up(double d) {
+    float f = static_cast<float>(d);
+    return f < d ? nextafterf(f, INFINITY) : f;
+}
+
+// t = (b - o) * inv 的三次舍入 (减法、求倒数、乘法) 相对误差不超过
+// gamma(3), 远端距离放大 1 + 2 * gamma(3) 后不会漏掉与 float 包围盒
+// 相交的光线 (PBRT 3.9.2); 误差是相对于起点已舍入为 float 的光线而言
+constexpr float SlabGamma3 =
+    (3.0f * FLT_EPSILON * 0.5f) / (1.0f - 3.0f * FLT_EPSILON * 0.5f);
+constexpr float SlabRobustScale = 1.0f + 2.0f * SlabGamma3;
+
+// 无分支的 slab 测试, bounds 为平铺的 {min xyz, max xyz}
+// 按预计算的下标取近/远平面, 三轴的 max/min 互相独立, 编译为 maxss/minss;
+// traversal_ray 保证 inv 有限, 这里不会出现 NaN
+inline bool slab_hit(const float *bounds, const traversal_ray &r, float tmin,
+                     float tmax) {
+    float tx0 = (bounds[r.near[0]] - r.org[0]) * r.inv[0];
+    float tx1 = (bounds[r.far[0]] - r.org[0]) * r.inv[0];
+    float ty0 = (bounds[r.near[1]] - r.org[1]) * r.inv[1];
+    float ty1 = (bounds[r.far[1]] - r.org[1]) * r.inv[1];
+    float tz0 = (bounds[r.near[2]] - r.org[2]) * r.inv[2];
+    float tz1 = (bounds[r.far[2]] - r.org[2]) * r.inv[2];
+    float tnear = std::max(std::max(tx0, tmin), std::max(ty0, tz0));
+    float tfar = std::min(std::min(tx1, ty1), tz1) * SlabRobustScale;
+    return tnear <= std::min(tfar, tmax);
+}
+
+inline bool AABB::hit(const traversal_ray &r, float tmin, float tmax) const {
+    // 向外取整, 转换后的包围盒不会比原来小; 每次都要转换,
+    // 频繁测试同一个包围盒时应像 BVHNode 一样预先转换好
+    float bounds[6] = {round_down(_min[0]), round_down(_min[1]),
+                       round_down(_min[2]), round_up(_max[0]),
+                       round_up(_max[1]),   round_up(_max[2])};
+    return slab_hit(bounds, r, tmin, tmax);
+}
+
 AABB surrounding_box(AABB box0, AABB box1) {
     vec3 small(fmin(box0.min().x(), box1.min().x()),
                fmin(box0.min().y(), box1.min().y()),
@@ -48,4 +99,15 @@ AABB surrounding_box(AABB box0, AABB box1) {
     return AABB(small, big);
 }
 
+// 两个包围盒的交集, 不相交时某一轴上 min > max
+AABB overlap_box(AABB box0, AABB box1) {
+    vec3 small(fmax(box0.min().x(), box1.min().x()),
+               fmax(box0.min().y(), box1.min().y()),
+               fmax(box0.min().z(), box1.min().z()));
+    vec3 big(fmin(box0.max().x(), box1.max().x()),
+             fmin(box0.max().y(), box1.max().y()),
+             fmin(box0.max().z(), box1.max().z()));
+    return AABB(small, big);
+}
+
 #endif // RAYTRACE_AABB_HPP
@@ -29,8 +29,30 @@ public:
             double time0, double time1);
     virtual bool hit(const ray &r, float tmin, float tmax,
                      hit_record &rec) const override;
+    virtual bool occluded(const ray &r, float tmin,
+                          float tmax) const override;
+    virtual void all_hits(const ray &r, float t_min, float t_max,
+                          hit_collector &out) const override;
     virtual bool bounding_box(float t0, float t1,
                               AABB &output_box) const override;
+
+private:
+    bool hit(const ray &r, const traversal_ray &tr, float t_min, float t_max,
+             hit_record &rec) const;
+    static bool hit_child(const shared_ptr<hittable> &child,
+                          const BVHNode *node, const ray &r,
+                          const traversal_ray &tr, float t_min, float t_max,
+                          hit_record &rec);
+    bool occluded(const ray &r, const traversal_ray &tr, float t_min,
+                  float t_max) const;
+    void all_hits(const ray &r, const traversal_ray &tr, float t_min,
+                  float t_max, hit_collector &out) const;
+
+    // 孩子是 BVHNode 时直接递归, 沿用同一个 traversal_ray
+    const BVHNode *left_node = nullptr;
+    const BVHNode *right_node = nullptr;
+    // box 向外取整为 float 后平铺的 {min xyz, max xyz}, 遍历时直接 slab 测试
+    float bounds[6] = {0};
 };
 
 bool BVHNode::bounding_box(float t0, float t1, AABB &output_box) const {
@@ -40,15 +62,72 @@ bool BVHNode::bounding_box(float t0, float t1, AABB &output_box) const {
 
 bool BVHNode::hit(const ray &r, float t_min, float t_max,
                   hit_record &rec) const {
-    if (!box.hit(r, t_min, t_max))
+    return hit(r, traversal_ray(r), t_min, t_max, rec);
+}
+
+bool BVHNode::hit_child(const shared_ptr<hittable> &child,
+                        const BVHNode *node, const ray &r,
+                        const traversal_ray &tr, float t_min, float t_max,
+                        hit_record &rec) {
+    return node ? node->hit(r, tr, t_min, t_max, rec)
+                : child->hit(r, t_min, t_max, rec);
+}
+
+bool BVHNode::hit(const ray &r, const traversal_ray &tr, float t_min,
+                  float t_max, hit_record &rec) const {
+    if (!slab_hit(bounds, tr, t_min, t_max))
         return false;
 
-    bool hit_left = left->hit(r, t_min, t_max, rec);
-    bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
+    // 单物体叶子 left == right, 只求交一次
+    if (left == right)
+        return hit_child(left, left_node, r, tr, t_min, t_max, rec);
+
+    bool hit_left = hit_child(left, left_node, r, tr, t_min, t_max, rec);
+    bool hit_right = hit_child(right, right_node, r, tr, t_min,
+                               hit_left ? rec.t : t_max, rec);
 
     return hit_left || hit_right;
 }
 
+bool BVHNode::occluded(const ray &r, float t_min, float t_max) const {
+    return occluded(r, traversal_ray(r), t_min, t_max);
+}
+
+bool BVHNode::occluded(const ray &r, const traversal_ray &tr, float t_min,
+                       float t_max) const {
+    if (!slab_hit(bounds, tr, t_min, t_max))
+        return false;
+    auto child_occluded = [&](const shared_ptr<hittable> &child,
+                              const BVHNode *node) {
+        return node ? node->occluded(r, tr, t_min, t_max)
+                    : child->occluded(r, t_min, t_max);
+    };
+    if (child_occluded(left, left_node))
+        return true;
+    return left != right && child_occluded(right, right_node);
+}
+
+void BVHNode::all_hits(const ray &r, float t_min, float t_max,
+                       hit_collector &out) const {
+    all_hits(r, traversal_ray(r), t_min, t_max, out);
+}
+
+void BVHNode::all_hits(const ray &r, const traversal_ray &tr, float t_min,
+                       float t_max, hit_collector &out) const {
+    if (!slab_hit(bounds, tr, t_min, out.bound(t_max)))
+        return;
+    auto child_hits = [&](const shared_ptr<hittable> &child,
+                          const BVHNode *node) {
+        if (node)
+            node->all_hits(r, tr, t_min, t_max, out);
+        else
+            child->all_hits(r, t_min, out.bound(t_max), out);
+    };
+    child_hits(left, left_node);
+    if (left != right)
+        child_hits(right, right_node);
+}
+
 inline bool box_compare(const shared_ptr<hittable> a,
                         const shared_ptr<hittable> b, int axis) {
     AABB box_a;
@@ -205,6 +284,12 @@ BVHNode::BVHNode(std::vector<shared_ptr<hittable>> &objects, int l, int r,
         std::cerr << "No bounding box in bvh_node constructor.\n";
 
     box = surrounding_box(box_left, box_right);
+    left_node = dynamic_cast<const BVHNode *>(left.get());
+    right_node = dynamic_cast<const BVHNode *>(right.get());
+    for (int a = 0; a < 3; a++) {
+        bounds[a] = round_down(box.min()[a]);
+        bounds[3 + a] = round_up(box.max()[a]);
+    }
 }
 
 #endif // RAYTRACE_BVH_HPP
@@ -0,0 +1,1265 @@
+#ifndef RAYTRACE_BVHBUILDER_HPP
+#define RAYTRACE_BVHBUILDER_HPP
+
+#include "./AABB.hpp"
+#include "./BVH.hpp"
+#include "./LinearBVH.hpp"
+#include "./hittable.hpp"
+#include "./vec3.hpp"
+#include "omp.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cfloat>
+#include <iostream>
+#include <vector>
+using namespace std;
+
+// BVH 构建方式
+enum BVHBuildMethod {
+    BVH_SWEEP,     // BVHNode 原有的三轴排序扫描 SAH, 再展开
+    BVH_BINNED_SAH, // 质心分桶 SAH, 直接输出线性节点
+    BVH_LBVH,       // Morton 码排序后线性时间生成, 构建最快
+    BVH_HLBVH,      // 簇内 LBVH, 顶层按 SAH 重建
+    BVH_SBVH        // 分桶 SAH 加空间划分, 复制并裁剪跨越平面的物体引用
+};
+
+struct BVHBuildOptions {
+    BVHBuildMethod method = BVH_BINNED_SAH;
+    int nBuckets = 16;          // 分桶数, 不超过 SAHBuilder::MaxBuckets
+    float traversalCost = 1.0f; // 访问一个内部节点的代价
+    float intersectCost = 1.0f; // 与一个物体求交的代价
+    // 叶子最多物体数, 不超过时由 SAH 终止代价决定是否继续划分
+    int maxLeafSize = 8;
+    int taskThreshold = 4096; // 物体数不少于该值的子树作为并行任务构建
+    int threads = 0;          // 构建线程数, 0 表示 omp_get_max_threads()
+    int mortonBits = 30;      // LBVH: Morton 码位数, 30 或 63
+    int clusterBits = 12;     // HLBVH: 用于分簇的 Morton 码高位数
+    // update_bvh: refit 后 SAH 代价超过构建时的该倍数则重建
+    float rebuildThreshold = 1.3f;
+    // SBVH: 空间划分复制的引用数最多为物体数的该比例
+    float spatialSplitBudget = 0.3f;
+    // 运动 BVH: 每条路径上最多的时间划分次数
+    int maxTimeSplits = 3;
+    // 运动 BVH: 节点扫过的包围盒面积超过静态面积的该倍数时才尝试时间划分
+    float timeSplitMotion = 2.0f;
+    // 延迟 BVH: 物体数不超过该值的子树推迟到第一次被访问时构建
+    int lazySubtreeSize = 4096;
+};
+
+// 构建时每个物体只需要包围盒、质心和原下标
+struct BVHPrimitiveInfo {
+    AABB box;
+    vec3 centroid;
+    int index;
+};
+
+inline AABB empty_box() {
+    return AABB(vec3(DBL_MAX, DBL_MAX, DBL_MAX),
+                vec3(-DBL_MAX, -DBL_MAX, -DBL_MAX));
+}
+
+inline int build_threads(const BVHBuildOptions &opts) {
+    return opts.threads > 0 ? opts.threads : omp_get_max_threads();
+}
+
+// 并行收集所有物体的包围盒与质心
+vector<BVHPrimitiveInfo>
+primitive_info(const vector<shared_ptr<hittable>> &objects, double time0,
+               double time1, int threads) {
+    int n = objects.size();
+    vector<BVHPrimitiveInfo> info(n);
+#pragma omp parallel for num_threads(threads)
+    for (int i = 0; i < n; i++) {
+        if (!objects[i]->bounding_box(time0, time1, info[i].box))
+            std::cerr << "No bounding box in BVH builder.\n";
+        info[i].centroid = 0.5 * (info[i].box.min() + info[i].box.max());
+        info[i].index = i;
+    }
+    return info;
+}
+
+// 质心分桶 SAH 构建
+// 在物体信息的平坦数组上原地划分, 每层只扫描一遍物体, 桶放在栈上,
+// 没有逐节点的堆分配, 复杂度 O(n log n)
+// 足够大的子树作为 OpenMP 任务并行构建, 顶层大节点的分桶与划分也按块并行;
+// 分块方式只取决于物体个数, 所以任意线程数下得到的树与串行构建完全相同
+class SAHBuilder {
+public:
+    static const int MaxBuckets = 64;
+    static const int ChunkSize = 16384; // 并行分桶/划分的块大小
+
+    SAHBuilder(const BVHBuildOptions &opts) : opts(opts) {}
+
+    void build(const vector<shared_ptr<hittable>> &objects, double time0,
+               double time1, LinearBVH &bvh);
+
+private:
+    struct Bucket {
+        int count = 0;
+        AABB box = empty_box();
+    };
+
+    // 构建阶段的节点, 先存入预分配的节点池, 再按深度优先顺序展开
+    struct BuildNode {
+        LinearBVHNode node;
+        int child[2];
+        int size; // 子树节点数
+    };
+
+    int recursive_build(vector<BVHPrimitiveInfo> &info, int start, int end,
+                        int depth);
+    int flatten(int pool_index, int out_index, int depth, LinearBVH &bvh);
+
+    void compute_bounds(const vector<BVHPrimitiveInfo> &info, int start,
+                        int end, AABB &bounds, AABB &centroid_bounds) const;
+    template <typename F>
+    void fill_buckets(const vector<BVHPrimitiveInfo> &info, int start,
+                      int end, F &&bucket_of, Bucket *buckets) const;
+    template <typename P>
+    int partition(vector<BVHPrimitiveInfo> &info, int start, int end,
+                  P &&pred) const;
+
+    BVHBuildOptions opts;
+    vector<BuildNode> pool;
+    atomic<int> pool_size{0};
+};
+
+void SAHBuilder::build(const vector<shared_ptr<hittable>> &objects,
+                       double time0, double time1, LinearBVH &bvh) {
+    int n = objects.size();
+    int threads = build_threads(opts);
+    auto info = primitive_info(objects, time0, time1, threads);
+
+    bvh.nodes.clear();
+    bvh.primitives.clear();
+    if (n == 0)
+        return;
+
+    // 每个叶子至少一个物体, 节点数不超过 2n - 1
+    pool.resize(2 * n);
+    pool_size = 0;
+    int root = 0, depth = 0;
+#pragma omp parallel num_threads(threads)
+#pragma omp single
+    {
+        root = recursive_build(info, 0, n, 0);
+        bvh.nodes.resize(pool[root].size);
+        depth = flatten(root, 0, 0, bvh);
+    }
+    bvh.stats.maxDepth = depth;
+    pool.clear();
+    pool.shrink_to_fit();
+
+    // 叶子引用的是划分后的顺序
+    bvh.primitives.resize(n);
+    for (int i = 0; i < n; i++)
+        bvh.primitives[i] = objects[info[i].index];
+}
+
+void SAHBuilder::compute_bounds(const vector<BVHPrimitiveInfo> &info,
+                                int start, int end, AABB &bounds,
+                                AABB &centroid_bounds) const {
+    auto accumulate = [&](int s, int e, AABB &b, AABB &c) {
+        b = empty_box();
+        c = empty_box();
+        for (int i = s; i < e; i++) {
+            b = surrounding_box(b, info[i].box);
+            c = surrounding_box(c, AABB(info[i].centroid, info[i].centroid));
+        }
+    };
+    int n = end - start;
+    if (n < 2 * ChunkSize) {
+        accumulate(start, end, bounds, centroid_bounds);
+        return;
+    }
+    // 最值的合并与顺序无关, 结果与串行相同
+    int chunks = (n + ChunkSize - 1) / ChunkSize;
+    vector<AABB> b(chunks), c(chunks);
+#pragma omp taskloop shared(info, b, c)
+    for (int k = 0; k < chunks; k++)
+        accumulate(start + k * ChunkSize, min(start + (k + 1) * ChunkSize, end),
+                   b[k], c[k]);
+    bounds = empty_box();
+    centroid_bounds = empty_box();
+    for (int k = 0; k < chunks; k++) {
+        bounds = surrounding_box(bounds, b[k]);
+        centroid_bounds = surrounding_box(centroid_bounds, c[k]);
+    }
+}
+
+template <typename F>
+void SAHBuilder::fill_buckets(const vector<BVHPrimitiveInfo> &info,
+                              int start, int end, F &&bucket_of,
+                              Bucket *buckets) const {
+    auto accumulate = [&](int s, int e, Bucket *out) {
+        for (int i = s; i < e; i++) {
+            Bucket &b = out[bucket_of(info[i].centroid)];
+            b.count++;
+            b.box = surrounding_box(b.box, info[i].box);
+        }
+    };
+    int n = end - start;
+    if (n < 2 * ChunkSize) {
+        accumulate(start, end, buckets);
+        return;
+    }
+    int chunks = (n + ChunkSize - 1) / ChunkSize;
+    vector<Bucket> partial(chunks * MaxBuckets);
+#pragma omp taskloop shared(info, partial)
+    for (int k = 0; k < chunks; k++)
+        accumulate(start + k * ChunkSize, min(start + (k + 1) * ChunkSize, end),
+                   &partial[k * MaxBuckets]);
+    for (int k = 0; k < chunks; k++)
+        for (int i = 0; i < MaxBuckets; i++) {
+            buckets[i].count += partial[k * MaxBuckets + i].count;
+            buckets[i].box =
+                surrounding_box(buckets[i].box, partial[k * MaxBuckets + i].box);
+        }
+}
+
+// 小区间用原地 std::partition; 大区间按块并行做稳定划分
+template <typename P>
+int SAHBuilder::partition(vector<BVHPrimitiveInfo> &info, int start, int end,
+                          P &&pred) const {
+    int n = end - start;
+    if (n < 2 * ChunkSize)
+        return std::partition(info.begin() + start, info.begin() + end,
+                              pred) -
+               info.begin();
+
+    int chunks = (n + ChunkSize - 1) / ChunkSize;
+    vector<int> left_count(chunks + 1, 0), right_count(chunks + 1, 0);
+#pragma omp taskloop shared(info, left_count, right_count)
+    for (int k = 0; k < chunks; k++) {
+        int s = start + k * ChunkSize, e = min(s + ChunkSize, end);
+        for (int i = s; i < e; i++)
+            left_count[k + 1] += pred(info[i]);
+        right_count[k + 1] = (e - s) - left_count[k + 1];
+    }
+    for (int k = 0; k < chunks; k++) {
+        left_count[k + 1] += left_count[k];
+        right_count[k + 1] += right_count[k];
+    }
+
+    int n_left = left_count[chunks];
+    vector<BVHPrimitiveInfo> tmp(n);
+#pragma omp taskloop shared(info, tmp, left_count, right_count)
+    for (int k = 0; k < chunks; k++) {
+        int s = start + k * ChunkSize, e = min(s + ChunkSize, end);
+        int l = left_count[k], r = n_left + right_count[k];
+        for (int i = s; i < e; i++)
+            tmp[pred(info[i]) ? l++ : r++] = info[i];
+    }
+#pragma omp taskloop shared(info, tmp)
+    for (int k = 0; k < chunks; k++) {
+        int s = k * ChunkSize, e = min(s + ChunkSize, n);
+        std::copy(tmp.begin() + s, tmp.begin() + e, info.begin() + start + s);
+    }
+    return start + n_left;
+}
+
+// 返回节点在节点池中的下标
+int SAHBuilder::recursive_build(vector<BVHPrimitiveInfo> &info, int start,
+                                int end, int depth) {
+    int index = pool_size++;
+    BuildNode &build_node = pool[index];
+    LinearBVHNode &node = build_node.node;
+    build_node.size = 1;
+
+    AABB bounds, centroid_bounds;
+    compute_bounds(info, start, end, bounds, centroid_bounds);
+    node.set_bounds(bounds);
+
+    int n = end - start;
+    int max_leaf = std::clamp(opts.maxLeafSize, 1, 65535);
+    auto make_leaf = [&]() {
+        node.primitivesOffset = start;
+        node.nPrimitives = n;
+        node.axis = 0;
+        return index;
+    };
+    if (n == 1)
+        return make_leaf();
+
+    // 选质心跨度最大的轴
+    vec3 extent = centroid_bounds.max() - centroid_bounds.min();
+    int dim = 0;
+    if (extent[1] > extent[dim])
+        dim = 1;
+    if (extent[2] > extent[dim])
+        dim = 2;
+
+    // 深度接近遍历栈上限时跳过 SAH, 直接按个数对半分
+    int mid = -1;
+    if (extent[dim] > 0 && !bvh_depth_limited(depth, n)) {
+        int nb = std::clamp(opts.nBuckets, 2, MaxBuckets);
+        double cmin = centroid_bounds.min()[dim];
+        auto bucket_of = [&](const vec3 &c) {
+            int b = nb * ((c[dim] - cmin) / extent[dim]);
+            return b >= nb ? nb - 1 : b;
+        };
+
+        Bucket buckets[MaxBuckets];
+        fill_buckets(info, start, end, bucket_of, buckets);
+
+        // 从右向左累积后缀, 再从左向右扫描求每个划分位置的代价
+        double right_area[MaxBuckets];
+        int right_count[MaxBuckets];
+        AABB acc = empty_box();
+        int count = 0;
+        for (int i = nb - 1; i > 0; i--) {
+            acc = surrounding_box(acc, buckets[i].box);
+            count += buckets[i].count;
+            right_area[i] = count ? acc.surface_area() : 0;
+            right_count[i] = count;
+        }
+
+        double inv_area = 1.0 / bounds.surface_area();
+        double min_cost = DBL_MAX;
+        int min_bucket = -1;
+        acc = empty_box();
+        count = 0;
+        for (int i = 0; i < nb - 1; i++) {
+            acc = surrounding_box(acc, buckets[i].box);
+            count += buckets[i].count;
+            if (count == 0 || right_count[i + 1] == 0)
+                continue;
+            double cost = opts.traversalCost +
+                          opts.intersectCost *
+                              (count * acc.surface_area() +
+                               right_count[i + 1] * right_area[i + 1]) *
+                              inv_area;
+            if (cost < min_cost) {
+                min_cost = cost;
+                min_bucket = i;
+            }
+        }
+
+        // 划分不比把所有物体放进一个叶子更便宜时生成叶子
+        double leaf_cost = opts.intersectCost * n;
+        if (n <= max_leaf && min_cost >= leaf_cost)
+            return make_leaf();
+
+        if (min_bucket >= 0)
+            mid = partition(info, start, end, [&](const BVHPrimitiveInfo &p) {
+                return bucket_of(p.centroid) <= min_bucket;
+            });
+    }
+
+    // 质心重合、包围盒退化或深度受限时按个数对半分
+    if (mid <= start || mid >= end) {
+        if (n <= max_leaf)
+            return make_leaf();
+        mid = (start + end) / 2;
+        std::nth_element(info.begin() + start, info.begin() + mid,
+                         info.begin() + end,
+                         [dim](const BVHPrimitiveInfo &a,
+                               const BVHPrimitiveInfo &b) {
+                             return a.centroid[dim] < b.centroid[dim];
+                         });
+    }
+
+    int left, right;
+    if (n >= opts.taskThreshold) {
+#pragma omp task shared(info, left)
+        left = recursive_build(info, start, mid, depth + 1);
+        right = recursive_build(info, mid, end, depth + 1);
+#pragma omp taskwait
+    } else {
+        left = recursive_build(info, start, mid, depth + 1);
+        right = recursive_build(info, mid, end, depth + 1);
+    }
+    build_node.child[0] = left;
+    build_node.child[1] = right;
+    build_node.size = 1 + pool[left].size + pool[right].size;
+    node.nPrimitives = 0;
+    node.axis = dim;
+    return index;
+}
+
+// 把节点池中的子树按深度优先顺序写到 out_index 起的位置, 返回子树最大深度
+int SAHBuilder::flatten(int pool_index, int out_index, int depth,
+                        LinearBVH &bvh) {
+    const BuildNode &build_node = pool[pool_index];
+    bvh.nodes[out_index] = build_node.node;
+    if (build_node.node.nPrimitives > 0)
+        return depth;
+
+    // 第一个孩子紧随其后, 第二个孩子在第一个孩子的整棵子树之后
+    int left = build_node.child[0], right = build_node.child[1];
+    int second = out_index + 1 + pool[left].size;
+    bvh.nodes[out_index].secondChildOffset = second;
+
+    int left_depth, right_depth;
+    if (build_node.size >= opts.taskThreshold) {
+#pragma omp task shared(bvh, left_depth)
+        left_depth = flatten(left, out_index + 1, depth + 1, bvh);
+        right_depth = flatten(right, second, depth + 1, bvh);
+#pragma omp taskwait
+    } else {
+        left_depth = flatten(left, out_index + 1, depth + 1, bvh);
+        right_depth = flatten(right, second, depth + 1, bvh);
+    }
+    return max(left_depth, right_depth);
+}
+
+// 把 21 位整数的各位间隔两位展开, 用于交织 Morton 码
+inline uint64_t expand_bits3(uint64_t x) {
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x << 8) & 0x100f00f00f00f00fULL;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2) & 0x1249249249249249ULL;
+    return x;
+}
+
+// 物体质心的 Morton 码与原下标
+struct MortonPrimitive {
+    uint64_t code;
+    int index;
+};
+
+// 并行 LSD 基数排序, 每趟 8 位
+// 按固定大小分块统计直方图, 按块顺序求前缀和, 排序稳定且与线程数无关
+void radix_sort(vector<MortonPrimitive> &v, int bits, int threads) {
+    const int ChunkSize = 16384;
+    int n = v.size();
+    int chunks = (n + ChunkSize - 1) / ChunkSize;
+    vector<MortonPrimitive> tmp(n);
+    vector<int> offset(chunks * 256);
+    for (int shift = 0; shift < bits; shift += 8) {
+        std::fill(offset.begin(), offset.end(), 0);
+#pragma omp parallel for num_threads(threads)
+        for (int k = 0; k < chunks; k++) {
+            int *hist = &offset[k * 256];
+            for (int i = k * ChunkSize; i < min(n, (k + 1) * ChunkSize); i++)
+                hist[(v[i].code >> shift) & 0xff]++;
+        }
+        // 按 (桶, 块) 的顺序求排他前缀和
+        int sum = 0;
+        for (int d = 0; d < 256; d++)
+            for (int k = 0; k < chunks; k++) {
+                int count = offset[k * 256 + d];
+                offset[k * 256 + d] = sum;
+                sum += count;
+            }
+#pragma omp parallel for num_threads(threads)
+        for (int k = 0; k < chunks; k++) {
+            int *out = &offset[k * 256];
+            for (int i = k * ChunkSize; i < min(n, (k + 1) * ChunkSize); i++)
+                tmp[out[(v[i].code >> shift) & 0xff]++] = v[i];
+        }
+        v.swap(tmp);
+    }
+}
+
+// LBVH / HLBVH 构建
+// 质心量化成 Morton 码后基数排序, 再按 Karras 的方法由相邻码的公共前缀
+// 独立地确定每个内部节点, 整个层次在线性时间内生成
+// HLBVH 先按 Morton 码高位分簇, 簇内用 LBVH, 簇之上的顶层用分桶 SAH 重建
+class LBVHBuilder {
+public:
+    LBVHBuilder(const BVHBuildOptions &opts) : opts(opts) {}
+
+    void build(const vector<shared_ptr<hittable>> &objects, double time0,
+               double time1, LinearBVH &bvh);
+
+private:
+    // 节点池中的节点: [0, n) 为 Karras 内部节点, [n, 2n) 为单物体叶子,
+    // 之后是 HLBVH 的顶层节点
+    struct BuildNode {
+        AABB box;
+        int child[2];
+        int first, count; // 覆盖的排序后物体区间
+        int axis;
+        int size;    // 折叠叶子后的子树节点数
+        int height;  // 折叠叶子后的子树高度
+        double cost; // 未归一化的子树 SAH 代价
+        bool leaf;
+        bool median; // 超出深度上限, 展开时把区间按个数对半重新划分
+    };
+
+    int common_prefix(int i, int j, int lo, int hi) const;
+    void emit_internal(int i, int lo, int hi);
+    void summarize(int index);
+    int build_upper(vector<int> &roots, int start, int end, int depth);
+    void limit_depth(int index, int depth);
+    int median_size(int count) const;
+    int flatten(int pool_index, int out_index, int depth, LinearBVH &bvh);
+    int flatten_median(int first, int count, int out_index, int depth,
+                       LinearBVH &bvh);
+
+    BVHBuildOptions opts;
+    int n = 0;
+    vector<MortonPrimitive> morton;
+    vector<BVHPrimitiveInfo> info;
+    vector<BuildNode> pool;
+    atomic<int> pool_size{0};
+};
+
+void LBVHBuilder::build(const vector<shared_ptr<hittable>> &objects,
+                        double time0, double time1, LinearBVH &bvh) {
+    n = objects.size();
+    int threads = build_threads(opts);
+    bvh.nodes.clear();
+    bvh.primitives.clear();
+    if (n == 0)
+        return;
+    info = primitive_info(objects, time0, time1, threads);
+
+    // 质心包围盒内量化, 每轴 10 位 (30 位码) 或 21 位 (63 位码)
+    AABB centroid_bounds = empty_box();
+    for (const auto &p : info)
+        centroid_bounds = surrounding_box(
+            centroid_bounds, AABB(p.centroid, p.centroid));
+    int axis_bits = opts.mortonBits > 30 ? 21 : 10;
+    int code_bits = 3 * axis_bits;
+    double scale[3];
+    for (int a = 0; a < 3; a++) {
+        double extent = centroid_bounds.max()[a] - centroid_bounds.min()[a];
+        scale[a] = extent > 0 ? (1 << axis_bits) / extent : 0;
+    }
+    morton.resize(n);
+#pragma omp parallel for num_threads(threads)
+    for (int i = 0; i < n; i++) {
+        uint64_t q[3];
+        for (int a = 0; a < 3; a++) {
+            double f = (info[i].centroid[a] - centroid_bounds.min()[a]) *
+                       scale[a];
+            q[a] = min((uint64_t)f, ((uint64_t)1 << axis_bits) - 1);
+        }
+        // x 在每组三位的最高位, 划分位 b 对应的轴为 2 - b % 3
+        morton[i].code = expand_bits3(q[0]) << 2 |
+                         expand_bits3(q[1]) << 1 | expand_bits3(q[2]);
+        morton[i].index = i;
+    }
+    radix_sort(morton, code_bits, threads);
+
+    // LBVH 整体是一个簇; HLBVH 按高 clusterBits 位分簇
+    vector<int> starts;
+    int cluster_bits = opts.method == BVH_HLBVH
+                           ? std::clamp(opts.clusterBits, 0, code_bits)
+                           : 0;
+    int cluster_shift = code_bits - cluster_bits;
+    for (int i = 0; i < n; i++)
+        if (i == 0 || (morton[i].code >> cluster_shift) !=
+                          (morton[i - 1].code >> cluster_shift))
+            starts.push_back(i);
+    starts.push_back(n);
+    int clusters = starts.size() - 1;
+
+    pool.resize(2 * n + clusters);
+    pool_size = 2 * n;
+#pragma omp parallel for num_threads(threads)
+    for (int i = 0; i < n; i++) {
+        BuildNode &leaf = pool[n + i];
+        leaf.child[0] = leaf.child[1] = -1;
+        leaf.first = i;
+        leaf.count = 1;
+        leaf.axis = 0;
+        leaf.leaf = true;
+        leaf.median = false;
+        int c = upper_bound(starts.begin(), starts.end(), i) - starts.begin();
+        // 每个簇 [lo, hi) 有 hi - lo - 1 个内部节点, 下标为 lo .. hi - 2
+        if (i < starts[c] - 1)
+            emit_internal(i, starts[c - 1], starts[c]);
+    }
+
+    vector<int> roots(clusters);
+    for (int c = 0; c < clusters; c++)
+        roots[c] = starts[c + 1] - starts[c] > 1 ? starts[c] : n + starts[c];
+
+    int root = 0, depth = 0;
+#pragma omp parallel num_threads(threads)
+#pragma omp single
+    {
+        // 自底向上求包围盒与代价, 并把便宜的小子树折叠成叶子
+        for (int c = 0; c < clusters; c++)
+#pragma omp task
+            summarize(roots[c]);
+#pragma omp taskwait
+        root = build_upper(roots, 0, clusters, 0);
+        limit_depth(root, 0);
+        bvh.nodes.resize(pool[root].size);
+        depth = flatten(root, 0, 0, bvh);
+    }
+    bvh.stats.maxDepth = depth;
+
+    bvh.primitives.resize(n);
+    for (int i = 0; i < n; i++)
+        bvh.primitives[i] = objects[morton[i].index];
+    pool.clear();
+    pool.shrink_to_fit();
+    morton.clear();
+    info.clear();
+}
+
+// 排序后第 i, j 个码在簇 [lo, hi) 内的公共前缀长度, 簇外为 -1
+// 码相同时用下标继续区分, 保证重复码也能生成合法的树
+int LBVHBuilder::common_prefix(int i, int j, int lo, int hi) const {
+    if (j < lo || j >= hi)
+        return -1;
+    uint64_t a = morton[i].code, b = morton[j].code;
+    if (a == b)
+        return 64 + __builtin_clz((uint32_t)(i ^ j));
+    return __builtin_clzll(a ^ b);
+}
+
+// Karras 2012: 由第 i 个码与相邻码的公共前缀确定内部节点 i 覆盖的区间与划分位置
+void LBVHBuilder::emit_internal(int i, int lo, int hi) {
+    int d = common_prefix(i, i + 1, lo, hi) > common_prefix(i, i - 1, lo, hi)
+                ? 1
+                : -1;
+    int delta_min = common_prefix(i, i - d, lo, hi);
+    int l_max = 2;
+    while (common_prefix(i, i + l_max * d, lo, hi) > delta_min)
+        l_max *= 2;
+    int l = 0;
+    for (int t = l_max / 2; t >= 1; t /= 2)
+        if (common_prefix(i, i + (l + t) * d, lo, hi) > delta_min)
+            l += t;
+    int j = i + l * d;
+
+    // 二分查找区间内公共前缀变短的位置
+    int delta_node = common_prefix(i, j, lo, hi);
+    int s = 0;
+    for (int div = 2;; div *= 2) {
+        int t = (l + div - 1) / div;
+        if (common_prefix(i, i + (s + t) * d, lo, hi) > delta_node)
+            s += t;
+        if (t <= 1)
+            break;
+    }
+    int gamma = i + s * d + min(d, 0);
+    int first = min(i, j), last = max(i, j);
+
+    BuildNode &node = pool[i];
+    // 区间端点恰为划分位置时孩子是单物体叶子
+    node.child[0] = first == gamma ? n + gamma : gamma;
+    node.child[1] = last == gamma + 1 ? n + gamma + 1 : gamma + 1;
+    node.first = first;
+    node.count = last - first + 1;
+    node.leaf = false;
+    node.median = false;
+    uint64_t diff = morton[gamma].code ^ morton[gamma + 1].code;
+    node.axis = diff ? 2 - (63 - __builtin_clzll(diff)) % 3 : 0;
+}
+
+void LBVHBuilder::summarize(int index) {
+    BuildNode &node = pool[index];
+    if (index >= n) {
+        node.box = info[morton[node.first].index].box;
+        node.cost = opts.intersectCost * node.box.surface_area();
+        node.size = 1;
+        node.height = 0;
+        return;
+    }
+
+    int left = node.child[0], right = node.child[1];
+    if (node.count >= opts.taskThreshold) {
+#pragma omp task
+        summarize(left);
+        summarize(right);
+#pragma omp taskwait
+    } else {
+        summarize(left);
+        summarize(right);
+    }
+    node.box = surrounding_box(pool[left].box, pool[right].box);
+    double area = node.box.surface_area();
+    node.cost = opts.traversalCost * area + pool[left].cost + pool[right].cost;
+    double leaf_cost = opts.intersectCost * node.count * area;
+    if (node.count <= std::clamp(opts.maxLeafSize, 1, 65535) &&
+        leaf_cost <= node.cost) {
+        node.leaf = true;
+        node.cost = leaf_cost;
+        node.size = 1;
+        node.height = 0;
+    } else {
+        node.size = 1 + pool[left].size + pool[right].size;
+        node.height = 1 + max(pool[left].height, pool[right].height);
+    }
+}
+
+// HLBVH 的顶层: 以各簇的子树为单位做分桶 SAH, 代价按簇内物体数加权
+// 按簇数对半分时, 最深的叶子不超过 depth + ceil(log2 簇数)
+// + ceil(log2 最大簇的物体数), 该值到达上限时不再用 SAH
+int LBVHBuilder::build_upper(vector<int> &roots, int start, int end,
+                             int depth) {
+    if (end - start == 1)
+        return roots[start];
+
+    AABB bounds = empty_box(), centroid_bounds = empty_box();
+    auto centroid = [&](int r) {
+        return 0.5 * (pool[r].box.min() + pool[r].box.max());
+    };
+    int max_count = 0;
+    for (int i = start; i < end; i++) {
+        bounds = surrounding_box(bounds, pool[roots[i]].box);
+        vec3 c = centroid(roots[i]);
+        centroid_bounds = surrounding_box(centroid_bounds, AABB(c, c));
+        max_count = max(max_count, pool[roots[i]].count);
+    }
+    int cluster_levels = 0;
+    while ((1 << cluster_levels) < end - start)
+        cluster_levels++;
+    vec3 extent = centroid_bounds.max() - centroid_bounds.min();
+    int dim = 0;
+    if (extent[1] > extent[dim])
+        dim = 1;
+    if (extent[2] > extent[dim])
+        dim = 2;
+
+    int mid = -1;
+    if (extent[dim] > 0 &&
+        !bvh_depth_limited(depth + cluster_levels, max_count)) {
+        const int nb = 16;
+        double cmin = centroid_bounds.min()[dim];
+        auto bucket_of = [&](int r) {
+            int b = nb * ((centroid(r)[dim] - cmin) / extent[dim]);
+            return b >= nb ? nb - 1 : b;
+        };
+        int count[nb] = {0};
+        AABB box[nb];
+        std::fill(box, box + nb, empty_box());
+        for (int i = start; i < end; i++) {
+            int b = bucket_of(roots[i]);
+            count[b] += pool[roots[i]].count;
+            box[b] = surrounding_box(box[b], pool[roots[i]].box);
+        }
+
+        double min_cost = DBL_MAX;
+        int min_bucket = -1;
+        for (int i = 0; i < nb - 1; i++) {
+            AABB b0 = empty_box(), b1 = empty_box();
+            int c0 = 0, c1 = 0;
+            for (int j = 0; j <= i; j++) {
+                b0 = surrounding_box(b0, box[j]);
+                c0 += count[j];
+            }
+            for (int j = i + 1; j < nb; j++) {
+                b1 = surrounding_box(b1, box[j]);
+                c1 += count[j];
+            }
+            if (c0 == 0 || c1 == 0)
+                continue;
+            double cost = c0 * b0.surface_area() + c1 * b1.surface_area();
+            if (cost < min_cost) {
+                min_cost = cost;
+                min_bucket = i;
+            }
+        }
+        if (min_bucket >= 0)
+            mid = std::partition(roots.begin() + start, roots.begin() + end,
+                                 [&](int r) {
+                                     return bucket_of(r) <= min_bucket;
+                                 }) -
+                  roots.begin();
+    }
+    if (mid <= start || mid >= end) {
+        mid = (start + end) / 2;
+        std::nth_element(roots.begin() + start, roots.begin() + mid,
+                         roots.begin() + end, [&](int a, int b) {
+                             return centroid(a)[dim] < centroid(b)[dim];
+                         });
+    }
+
+    int index = pool_size++;
+    int left = build_upper(roots, start, mid, depth + 1);
+    int right = build_upper(roots, mid, end, depth + 1);
+    BuildNode &node = pool[index];
+    node.box = bounds;
+    node.child[0] = left;
+    node.child[1] = right;
+    node.count = pool[left].count + pool[right].count;
+    node.axis = dim;
+    node.leaf = false;
+    node.median = false;
+    node.size = 1 + pool[left].size + pool[right].size;
+    node.height = 1 + max(pool[left].height, pool[right].height);
+    return index;
+}
+
+// Karras 的划分由 Morton 码决定, 码分布不均时可能很深
+// 自顶向下找出会超出深度上限的簇内子树, 改为按个数对半划分其区间;
+// 顶层由 build_upper 保证每个簇的根都留有足够的深度
+void LBVHBuilder::limit_depth(int index, int depth) {
+    BuildNode &node = pool[index];
+    if (node.leaf || depth + node.height <= LinearBVH::MaxDepth - 1)
+        return;
+    if (index < n && bvh_depth_limited(depth, node.count)) {
+        node.median = true;
+        node.size = median_size(node.count);
+        return;
+    }
+    limit_depth(node.child[0], depth + 1);
+    limit_depth(node.child[1], depth + 1);
+    node.size = 1 + pool[node.child[0]].size + pool[node.child[1]].size;
+}
+
+// 按个数对半划分 count 个物体得到的节点数
+int LBVHBuilder::median_size(int count) const {
+    if (count <= std::clamp(opts.maxLeafSize, 1, 65535))
+        return 1;
+    return 1 + median_size(count / 2) + median_size(count - count / 2);
+}
+
+int LBVHBuilder::flatten(int pool_index, int out_index, int depth,
+                         LinearBVH &bvh) {
+    const BuildNode &node = pool[pool_index];
+    if (node.median)
+        return flatten_median(node.first, node.count, out_index, depth, bvh);
+    LinearBVHNode &out = bvh.nodes[out_index];
+    out.set_bounds(node.box);
+    if (node.leaf) {
+        out.primitivesOffset = node.first;
+        out.nPrimitives = node.count;
+        out.axis = 0;
+        return depth;
+    }
+
+    int left = node.child[0], right = node.child[1];
+    int second = out_index + 1 + pool[left].size;
+    out.secondChildOffset = second;
+    out.nPrimitives = 0;
+    out.axis = node.axis;
+
+    int left_depth, right_depth;
+    if (node.size >= opts.taskThreshold) {
+#pragma omp task shared(bvh, left_depth)
+        left_depth = flatten(left, out_index + 1, depth + 1, bvh);
+        right_depth = flatten(right, second, depth + 1, bvh);
+#pragma omp taskwait
+    } else {
+        left_depth = flatten(left, out_index + 1, depth + 1, bvh);
+        right_depth = flatten(right, second, depth + 1, bvh);
+    }
+    return max(left_depth, right_depth);
+}
+
+// 排序后的物体 [first, first + count) 在中间切开, 区间仍按 Morton 码有序
+int LBVHBuilder::flatten_median(int first, int count, int out_index,
+                                int depth, LinearBVH &bvh) {
+    LinearBVHNode &out = bvh.nodes[out_index];
+    AABB box = empty_box();
+    for (int i = first; i < first + count; i++)
+        box = surrounding_box(box, info[morton[i].index].box);
+    out.set_bounds(box);
+    if (count <= std::clamp(opts.maxLeafSize, 1, 65535)) {
+        out.primitivesOffset = first;
+        out.nPrimitives = count;
+        out.axis = 0;
+        return depth;
+    }
+
+    int half = count / 2;
+    int second = out_index + 1 + median_size(half);
+    uint64_t diff = morton[first].code ^ morton[first + count - 1].code;
+    out.secondChildOffset = second;
+    out.nPrimitives = 0;
+    out.axis = diff ? 2 - (63 - __builtin_clzll(diff)) % 3 : 0;
+    int left_depth = flatten_median(first, half, out_index + 1, depth + 1, bvh);
+    int right_depth =
+        flatten_median(first + half, count - half, second, depth + 1, bvh);
+    return max(left_depth, right_depth);
+}
+
+// 空间划分 BVH (SBVH) 构建
+// 除了按质心划分物体, 还考虑在某个平面处切开节点: 跨过平面的物体引用
+// 复制到两侧, 各自裁剪到所在的一半 (hittable::clipped_bounding_box),
+// 大小三角形混杂时孩子之间的重叠大大减少
+// 只有最佳物体划分的两个孩子重叠明显时才尝试空间划分, 引用总数不超过
+// 物体数的 1 + spatialSplitBudget 倍, 叶子中同一物体可能出现多次
+// 构建是串行的, 比分桶 SAH 慢, 适合遍历时间比构建时间重要的网格
+class SBVHBuilder {
+public:
+    static const int MaxBuckets = SAHBuilder::MaxBuckets;
+    // 孩子重叠面积超过根节点面积的该比例时才尝试空间划分
+    static constexpr double SpatialSplitAlpha = 1e-5;
+
+    SBVHBuilder(const BVHBuildOptions &opts) : opts(opts) {}
+
+    void build(const vector<shared_ptr<hittable>> &objects, double time0,
+               double time1, LinearBVH &bvh);
+
+private:
+    // 物体引用: 空间划分后的包围盒只覆盖物体在节点内的部分
+    struct Reference {
+        AABB box;
+        int index;
+    };
+
+    struct Split {
+        double cost = DBL_MAX;
+        int axis = -1;
+        bool spatial = false;
+        double position = 0; // 物体划分: 质心坐标阈值; 空间划分: 平面坐标
+        AABB left, right;    // 两个孩子的包围盒
+        int n_left = 0, n_right = 0;
+    };
+
+    struct Bin {
+        AABB box = empty_box();
+        int count = 0; // 物体划分: 质心落在桶内的引用数; 空间划分: 从该桶进入
+        int exit = 0;  // 空间划分: 在该桶离开的引用数
+    };
+
+    void recursive_build(vector<Reference> &refs, int depth);
+    void object_split(const vector<Reference> &refs, double inv_area,
+                      Split &best) const;
+    void spatial_split(const vector<Reference> &refs, const AABB &bounds,
+                       double inv_area, Split &best) const;
+    void split_reference(const Reference &ref, int axis, double position,
+                         Reference &left, Reference &right) const;
+    static bool valid(const AABB &box) {
+        return box.min().x() <= box.max().x() &&
+               box.min().y() <= box.max().y() &&
+               box.min().z() <= box.max().z();
+    }
+    static vec3 centroid(const Reference &ref) {
+        return 0.5 * (ref.box.min() + ref.box.max());
+    }
+
+    BVHBuildOptions opts;
+    const vector<shared_ptr<hittable>> *objects = nullptr;
+    LinearBVH *bvh = nullptr;
+    double time0 = 0, time1 = 0;
+    double root_area = 0;
+    long max_refs = 0, n_refs = 0;
+};
+
+void SBVHBuilder::build(const vector<shared_ptr<hittable>> &objects,
+                        double time0, double time1, LinearBVH &bvh) {
+    this->objects = &objects;
+    this->bvh = &bvh;
+    this->time0 = time0;
+    this->time1 = time1;
+    bvh.nodes.clear();
+    bvh.primitives.clear();
+    bvh.stats = BVHBuildStats();
+    int n = objects.size();
+    if (n == 0)
+        return;
+
+    vector<Reference> refs(n);
+    for (int i = 0; i < n; i++) {
+        if (!objects[i]->bounding_box(time0, time1, refs[i].box))
+            std::cerr << "No bounding box in SBVH builder.\n";
+        refs[i].index = i;
+    }
+    n_refs = n;
+    max_refs = (long)(n * (1.0 + max(opts.spatialSplitBudget, 0.0f)));
+    bvh.nodes.reserve(2 * n);
+    bvh.primitives.reserve(max_refs);
+    recursive_build(refs, 0);
+    bvh.stats.duplication = (double)bvh.primitives.size() / n;
+}
+
+// 三个轴上分别按质心分桶
+void SBVHBuilder::object_split(const vector<Reference> &refs, double inv_area,
+                               Split &best) const {
+    AABB centroid_bounds = empty_box();
+    for (const auto &ref : refs)
+        centroid_bounds =
+            surrounding_box(centroid_bounds, AABB(centroid(ref), centroid(ref)));
+    int nb = std::clamp(opts.nBuckets, 2, MaxBuckets);
+    for (int axis = 0; axis < 3; axis++) {
+        double cmin = centroid_bounds.min()[axis];
+        double extent = centroid_bounds.max()[axis] - cmin;
+        if (extent <= 0)
+            continue;
+        Bin bins[MaxBuckets];
+        for (const auto &ref : refs) {
+            int b = nb * ((centroid(ref)[axis] - cmin) / extent);
+            Bin &bin = bins[b >= nb ? nb - 1 : b];
+            bin.count++;
+            bin.box = surrounding_box(bin.box, ref.box);
+        }
+        AABB right_box[MaxBuckets];
+        int right_count[MaxBuckets];
+        AABB acc = empty_box();
+        int count = 0;
+        for (int i = nb - 1; i > 0; i--) {
+            acc = surrounding_box(acc, bins[i].box);
+            count += bins[i].count;
+            right_box[i] = acc;
+            right_count[i] = count;
+        }
+        acc = empty_box();
+        count = 0;
+        for (int i = 0; i < nb - 1; i++) {
+            acc = surrounding_box(acc, bins[i].box);
+            count += bins[i].count;
+            if (count == 0 || right_count[i + 1] == 0)
+                continue;
+            double cost = opts.traversalCost +
+                          opts.intersectCost *
+                              (count * acc.surface_area() +
+                               right_count[i + 1] *
+                                   right_box[i + 1].surface_area()) *
+                              inv_area;
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = axis;
+                best.spatial = false;
+                best.position = cmin + (i + 1) * extent / nb;
+                best.left = acc;
+                best.right = right_box[i + 1];
+                best.n_left = count;
+                best.n_right = right_count[i + 1];
+            }
+        }
+    }
+}
+
+// 三个轴上分别把节点等分成若干段, 跨越多段的引用逐段裁剪;
+// 引用计入它进入的第一段和离开的最后一段
+void SBVHBuilder::spatial_split(const vector<Reference> &refs,
+                                const AABB &bounds, double inv_area,
+                                Split &best) const {
+    int nb = std::clamp(opts.nBuckets, 2, MaxBuckets);
+    for (int axis = 0; axis < 3; axis++) {
+        double lo = bounds.min()[axis];
+        double width = (bounds.max()[axis] - lo) / nb;
+        if (width <= 0)
+            continue;
+        auto bin_of = [&](double x) {
+            return std::clamp((int)((x - lo) / width), 0, nb - 1);
+        };
+        Bin bins[MaxBuckets];
+        for (const auto &ref : refs) {
+            int first = bin_of(ref.box.min()[axis]);
+            int last = bin_of(ref.box.max()[axis]);
+            bins[first].count++;
+            bins[last].exit++;
+            if (first == last) {
+                bins[first].box = surrounding_box(bins[first].box, ref.box);
+                continue;
+            }
+            for (int b = first; b <= last; b++) {
+                vec3 rmin = ref.box.min(), rmax = ref.box.max();
+                rmin[axis] = fmax(rmin[axis], lo + b * width);
+                rmax[axis] = fmin(rmax[axis], lo + (b + 1) * width);
+                AABB clipped;
+                (*objects)[ref.index]->clipped_bounding_box(
+                    AABB(rmin, rmax), time0, time1, clipped);
+                if (valid(clipped))
+                    bins[b].box = surrounding_box(bins[b].box, clipped);
+            }
+        }
+        AABB right_box[MaxBuckets];
+        int right_count[MaxBuckets];
+        AABB acc = empty_box();
+        int count = 0;
+        for (int i = nb - 1; i > 0; i--) {
+            acc = surrounding_box(acc, bins[i].box);
+            count += bins[i].exit;
+            right_box[i] = acc;
+            right_count[i] = count;
+        }
+        acc = empty_box();
+        count = 0;
+        for (int i = 0; i < nb - 1; i++) {
+            acc = surrounding_box(acc, bins[i].box);
+            count += bins[i].count;
+            if (count == 0 || right_count[i + 1] == 0)
+                continue;
+            double cost = opts.traversalCost +
+                          opts.intersectCost *
+                              (count * acc.surface_area() +
+                               right_count[i + 1] *
+                                   right_box[i + 1].surface_area()) *
+                              inv_area;
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = axis;
+                best.spatial = true;
+                best.position = lo + (i + 1) * width;
+                best.left = acc;
+                best.right = right_box[i + 1];
+                best.n_left = count;
+                best.n_right = right_count[i + 1];
+            }
+        }
+    }
+}
+
+// 把跨过平面的引用裁剪成两半, 某一半为空时其包围盒无效
+void SBVHBuilder::split_reference(const Reference &ref, int axis,
+                                  double position, Reference &left,
+                                  Reference &right) const {
+    vec3 lmax = ref.box.max(), rmin = ref.box.min();
+    lmax[axis] = position;
+    rmin[axis] = position;
+    left.index = right.index = ref.index;
+    const auto &obj = (*objects)[ref.index];
+    obj->clipped_bounding_box(AABB(ref.box.min(), lmax), time0, time1,
+                              left.box);
+    obj->clipped_bounding_box(AABB(rmin, ref.box.max()), time0, time1,
+                              right.box);
+}
+
+void SBVHBuilder::recursive_build(vector<Reference> &refs, int depth) {
+    bvh->stats.maxDepth = max(bvh->stats.maxDepth, depth);
+    int index = bvh->nodes.size();
+    bvh->nodes.emplace_back();
+
+    AABB bounds = empty_box();
+    for (const auto &ref : refs)
+        bounds = surrounding_box(bounds, ref.box);
+    bvh->nodes[index].set_bounds(bounds);
+    if (depth == 0)
+        root_area = bounds.surface_area();
+
+    int n = refs.size();
+    int max_leaf = std::clamp(opts.maxLeafSize, 1, 65535);
+    auto make_leaf = [&]() {
+        LinearBVHNode &node = bvh->nodes[index];
+        node.primitivesOffset = bvh->primitives.size();
+        node.nPrimitives = n;
+        node.axis = 0;
+        for (const auto &ref : refs)
+            bvh->primitives.push_back((*objects)[ref.index]);
+    };
+    if (n == 1) {
+        make_leaf();
+        return;
+    }
+
+    // 深度受限时跳过划分搜索, 在下面按质心对半分
+    Split best;
+    if (!bvh_depth_limited(depth, n)) {
+        double inv_area = 1.0 / max(bounds.surface_area(), DBL_MIN);
+        object_split(refs, inv_area, best);
+        // 只有最佳物体划分的两个孩子重叠明显、且引用数还在预算内时
+        // 才尝试空间划分
+        AABB overlap = overlap_box(best.left, best.right);
+        if (n_refs < max_refs &&
+            (best.axis < 0 ||
+             (valid(overlap) &&
+              overlap.surface_area() > SpatialSplitAlpha * root_area)))
+            spatial_split(refs, bounds, inv_area, best);
+
+        double leaf_cost = opts.intersectCost * n;
+        if (n <= max_leaf && best.cost >= leaf_cost) {
+            make_leaf();
+            return;
+        }
+    }
+
+    vector<Reference> left, right;
+    int axis = best.axis;
+    if (axis >= 0 && !best.spatial) {
+        for (const auto &ref : refs)
+            (centroid(ref)[axis] < best.position ? left : right).push_back(ref);
+    } else if (axis >= 0) {
+        // 跨过平面的引用先比较放到一侧 (不切开) 与切开的代价, 取最小者
+        AABB lbox = best.left, rbox = best.right;
+        int nl = best.n_left, nr = best.n_right;
+        for (const auto &ref : refs) {
+            if (ref.box.max()[axis] <= best.position) {
+                left.push_back(ref);
+                continue;
+            }
+            if (ref.box.min()[axis] >= best.position) {
+                right.push_back(ref);
+                continue;
+            }
+            double c_split = lbox.surface_area() * nl + rbox.surface_area() * nr;
+            AABB l_all = surrounding_box(lbox, ref.box);
+            AABB r_all = surrounding_box(rbox, ref.box);
+            double c_left = l_all.surface_area() * nl +
+                            rbox.surface_area() * (nr - 1);
+            double c_right = lbox.surface_area() * (nl - 1) +
+                             r_all.surface_area() * nr;
+            bool can_split = n_refs < max_refs;
+            if ((c_left < c_split || !can_split) && c_left <= c_right) {
+                left.push_back(ref);
+                lbox = l_all;
+                nr--;
+            } else if (c_right < c_split || !can_split) {
+                right.push_back(ref);
+                rbox = r_all;
+                nl--;
+            } else {
+                Reference l, r;
+                split_reference(ref, axis, best.position, l, r);
+                if (valid(l.box))
+                    left.push_back(l);
+                if (valid(r.box))
+                    right.push_back(r);
+                if (valid(l.box) && valid(r.box))
+                    n_refs++;
+            }
+        }
+    }
+
+    // 质心重合、划分失败或深度受限时按最长轴的质心对半分
+    if (left.empty() || right.empty()) {
+        if (n <= max_leaf) {
+            make_leaf();
+            return;
+        }
+        vec3 extent = bounds.max() - bounds.min();
+        axis = extent[1] > extent[0] ? 1 : 0;
+        if (extent[2] > extent[axis])
+            axis = 2;
+        int mid = n / 2;
+        std::nth_element(refs.begin(), refs.begin() + mid, refs.end(),
+                         [axis](const Reference &a, const Reference &b) {
+                             return centroid(a)[axis] < centroid(b)[axis];
+                         });
+        left.assign(refs.begin(), refs.begin() + mid);
+        right.assign(refs.begin() + mid, refs.end());
+    }
+    // 孩子构建前释放本节点的引用, 峰值内存与树高成正比而不是与节点数成正比
+    vector<Reference>().swap(refs);
+
+    recursive_build(left, depth + 1);
+    int second = bvh->nodes.size();
+    recursive_build(right, depth + 1);
+    LinearBVHNode &node = bvh->nodes[index];
+    node.secondChildOffset = second;
+    node.nPrimitives = 0;
+    node.axis = axis;
+}
+
+// 按选项构建线性 BVH, 并记录构建时间与 SAH 代价
+shared_ptr<LinearBVH> build_bvh(hittableList &list, double time0, double time1,
+                                const BVHBuildOptions &opts = BVHBuildOptions()) {
+    double start = omp_get_wtime();
+    shared_ptr<LinearBVH> bvh;
+    if (opts.method == BVH_SWEEP) {
+        bvh = make_shared<LinearBVH>(list, time0, time1);
+    } else if (opts.method == BVH_BINNED_SAH) {
+        bvh = make_shared<LinearBVH>();
+        SAHBuilder(opts).build(list.objects, time0, time1, *bvh);
+    } else if (opts.method == BVH_SBVH) {
+        bvh = make_shared<LinearBVH>();
+        SBVHBuilder(opts).build(list.objects, time0, time1, *bvh);
+    } else {
+        bvh = make_shared<LinearBVH>();
+        LBVHBuilder(opts).build(list.objects, time0, time1, *bvh);
+    }
+    bvh->stats.buildTime = omp_get_wtime() - start;
+    bvh->sah_cost(opts.traversalCost, opts.intersectCost);
+    bvh->stats.buildSahCost = bvh->stats.sahCost;
+    return bvh;
+}
+
+// 动画的每一帧调用: 物体移动后先 refit, 只有 SAH 代价退化过多时才重建
+// 返回更新后的 BVH, 重建时为新对象
+shared_ptr<LinearBVH>
+update_bvh(const shared_ptr<LinearBVH> &bvh, hittableList &list,
+           double time0, double time1,
+           const BVHBuildOptions &opts = BVHBuildOptions()) {
+    double ratio = bvh->refit(time0, time1, opts.threads, opts.traversalCost,
+                              opts.intersectCost);
+    if (ratio <= opts.rebuildThreshold)
+        return bvh;
+    return build_bvh(list, time0, time1, opts);
+}
+
+#endif // RAYTRACE_BVHBUILDER_HPP
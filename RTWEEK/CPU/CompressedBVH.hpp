@@ -0,0 +1,365 @@
+#ifndef RAYTRACE_COMPRESSEDBVH_HPP
+#define RAYTRACE_COMPRESSEDBVH_HPP
+
+#include "./AABB.hpp"
+#include "./BVHBuilder.hpp"
+#include "./LinearBVH.hpp"
+#include "./WideBVH.hpp"
+#include "./hittable.hpp"
+#include "./ray.hpp"
+#include "./vec3.hpp"
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+using namespace std;
+
+// 量化的 N 叉节点
+// 孩子包围盒存为相对节点原点的 8 位坐标, 每轴一个 2 的幂缩放:
+//   lo = origin + qlo * 2^exponent, hi = origin + qhi * 2^exponent
+// 内部孩子在节点数组中连续存放, 叶子孩子的物体在 primitives 中连续存放,
+// 所以只需两个基址和每个孩子的物体数
+// N = 4 时正好一条缓存行, N = 8 时两条, 都是未压缩节点的一半
+template <int N> struct alignas(64) CompressedWideBVHNode {
+    float origin[3];
+    int8_t exponent[3];
+    uint8_t nChildren;
+    uint8_t qlo[3][N];
+    uint8_t qhi[3][N];
+    int32_t childBase; // 第一个内部孩子的节点下标
+    int32_t primBase;  // 第一个叶子孩子的第一个物体下标
+    uint16_t count[N]; // 0 表示内部孩子, 否则为叶子的物体数
+};
+
+// 由 WideBVH 量化得到的压缩 N 叉 BVH, 用于包围盒数据超出缓存的大场景
+// 量化时下界向下取整、上界向上取整, 解压后的包围盒只会变大, 结果与 WideBVH 相同
+template <int N> class CompressedWideBVH : public hittable {
+    static_assert(N == 4 || N == 8,
+                  "CompressedWideBVH supports 4 or 8 children");
+
+public:
+    static const int MaxStack = WideBVH<N>::MaxStack;
+
+    CompressedWideBVH() = default;
+    explicit CompressedWideBVH(const WideBVH<N> &bvh);
+
+    virtual bool hit(const ray &r, float t_min, float t_max,
+                     hit_record &rec) const override;
+    virtual bool occluded(const ray &r, float t_min,
+                          float t_max) const override;
+    virtual void all_hits(const ray &r, float t_min, float t_max,
+                          hit_collector &out) const override;
+    virtual bool bounding_box(float t0, float t1,
+                              AABB &output_box) const override;
+
+    // 节点与物体指针数组占用的字节数
+    size_t memory_bytes() const {
+        return nodes.size() * sizeof(CompressedWideBVHNode<N>) +
+               primitives.size() * sizeof(shared_ptr<hittable>);
+    }
+
+    vector<CompressedWideBVHNode<N>> nodes;
+    vector<shared_ptr<hittable>> primitives;
+
+private:
+    void compress(const WideBVH<N> &bvh, int src, int dst);
+    int intersect_children(const CompressedWideBVHNode<N> &node,
+                           const traversal_ray &r, float t_min, float t_max,
+                           float tnear[N]) const;
+    // 孩子 i 的节点下标或物体下标
+    void child_offsets(const CompressedWideBVHNode<N> &node,
+                       int offsets[N]) const {
+        int next_child = node.childBase, next_prim = node.primBase;
+        for (int i = 0; i < node.nChildren; i++) {
+            if (node.count[i] == 0)
+                offsets[i] = next_child++;
+            else {
+                offsets[i] = next_prim;
+                next_prim += node.count[i];
+            }
+        }
+    }
+
+    AABB box;
+};
+
+template <int N>
+CompressedWideBVH<N>::CompressedWideBVH(const WideBVH<N> &bvh) {
+    if (bvh.nodes.empty())
+        return;
+    bvh.bounding_box(0, 0, box);
+    nodes.reserve(bvh.nodes.size());
+    primitives.reserve(bvh.primitives.size());
+    nodes.emplace_back();
+    compress(bvh, 0, 0);
+}
+
+// 把源节点 src 量化写入 dst, 再为它的内部孩子连续分配位置并递归
+template <int N>
+void CompressedWideBVH<N>::compress(const WideBVH<N> &bvh, int src, int dst) {
+    const WideBVHNode<N> &in = bvh.nodes[src];
+    CompressedWideBVHNode<N> out;
+    memset(&out, 0, sizeof(out));
+    out.nChildren = in.nChildren;
+    for (int a = 0; a < 3; a++) {
+        float lo = INFINITY, hi = -INFINITY;
+        for (int i = 0; i < in.nChildren; i++) {
+            lo = fminf(lo, in.bmin[a][i]);
+            hi = fmaxf(hi, in.bmax[a][i]);
+        }
+        // 取最小的 2 的幂, 使 255 格覆盖整个范围
+        int e = (int)ceil(log2(fmax((double)hi - lo, 1e-30) / 255.0));
+        e = max(e, -126);
+        double scale = ldexp(1.0, e);
+        while ((double)lo + 255.0 * scale < hi)
+            scale = ldexp(1.0, ++e);
+        out.origin[a] = lo;
+        out.exponent[a] = (int8_t)e;
+        for (int i = 0; i < N; i++) {
+            if (i >= in.nChildren) {
+                // 空位置的下界大于上界, 永远不会命中
+                out.qlo[a][i] = 255;
+                out.qhi[a][i] = 0;
+                continue;
+            }
+            double qlo = floor((in.bmin[a][i] - (double)lo) / scale);
+            double qhi = ceil((in.bmax[a][i] - (double)lo) / scale);
+            out.qlo[a][i] = (uint8_t)std::clamp(qlo, 0.0, 255.0);
+            out.qhi[a][i] = (uint8_t)std::clamp(qhi, 0.0, 255.0);
+        }
+    }
+
+    out.childBase = nodes.size();
+    out.primBase = primitives.size();
+    int internal = 0;
+    for (int i = 0; i < in.nChildren; i++) {
+        out.count[i] = in.count[i];
+        if (in.count[i] == 0)
+            internal++;
+        else
+            for (int k = 0; k < in.count[i]; k++)
+                primitives.push_back(bvh.primitives[in.child[i] + k]);
+    }
+    nodes.resize(nodes.size() + internal);
+    nodes[dst] = out;
+    int next = out.childBase;
+    for (int i = 0; i < in.nChildren; i++)
+        if (in.count[i] == 0)
+            compress(bvh, in.child[i], next++);
+}
+
+template <int N>
+bool CompressedWideBVH<N>::bounding_box(float t0, float t1,
+                                        AABB &output_box) const {
+    if (nodes.empty())
+        return false;
+    output_box = box;
+    return true;
+}
+
+// 解压的平面 origin + q * 2^exponent 只舍入一次, 误差不超过半个 ulp;
+// 再向外放宽 |x| * FLT_EPSILON (不小于一个 ulp) 后一定包含真实平面,
+// 之后与 slab_hit 一样按 (b - org) * inv 求距离并放大远端距离
+inline float dequantize_down(float x) { return x - fabsf(x) * FLT_EPSILON; }
+inline float dequantize_up(float x) { return x + fabsf(x) * FLT_EPSILON; }
+
+template <int N>
+int CompressedWideBVH<N>::intersect_children(
+    const CompressedWideBVHNode<N> &node, const traversal_ray &r, float t_min,
+    float t_max, float tnear[N]) const {
+    float scale[3];
+    for (int a = 0; a < 3; a++)
+        scale[a] = ldexpf(1.0f, node.exponent[a]);
+    int mask = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 sign = _mm_set1_ps(-0.0f), eps = _mm_set1_ps(FLT_EPSILON);
+    // 4 个 8 位坐标解压为 4 个 float 平面
+    auto load4 = [&](const uint8_t *q, int a) {
+        int32_t bits;
+        memcpy(&bits, q, 4);
+        __m128i v = _mm_cvtsi32_si128(bits);
+        v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(v, zero), zero);
+        return _mm_add_ps(_mm_set1_ps(node.origin[a]),
+                          _mm_mul_ps(_mm_cvtepi32_ps(v),
+                                     _mm_set1_ps(scale[a])));
+    };
+    for (int k = 0; k < N; k += 4) {
+        __m128 tn = _mm_set1_ps(t_min), tf = _mm_set1_ps(INFINITY);
+        for (int a = 0; a < 3; a++) {
+            __m128 lo = load4(node.qlo[a] + k, a);
+            __m128 hi = load4(node.qhi[a] + k, a);
+            lo = _mm_sub_ps(lo, _mm_mul_ps(_mm_andnot_ps(sign, lo), eps));
+            hi = _mm_add_ps(hi, _mm_mul_ps(_mm_andnot_ps(sign, hi), eps));
+            __m128 org = _mm_set1_ps(r.org[a]), inv = _mm_set1_ps(r.inv[a]);
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(lo, org), inv);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(hi, org), inv);
+            if (r.neg[a])
+                std::swap(t0, t1);
+            tn = _mm_max_ps(t0, tn);
+            tf = _mm_min_ps(t1, tf);
+        }
+        tf = _mm_min_ps(_mm_mul_ps(tf, _mm_set1_ps(SlabRobustScale)),
+                        _mm_set1_ps(t_max));
+        _mm_storeu_ps(tnear + k, tn);
+        mask |= _mm_movemask_ps(_mm_cmple_ps(tn, tf)) << k;
+    }
+#else
+    for (int i = 0; i < N; i++) {
+        float tn = t_min, tf = INFINITY;
+        for (int a = 0; a < 3; a++) {
+            float lo = dequantize_down(node.origin[a] +
+                                       node.qlo[a][i] * scale[a]);
+            float hi = dequantize_up(node.origin[a] +
+                                     node.qhi[a][i] * scale[a]);
+            float t0 = (lo - r.org[a]) * r.inv[a];
+            float t1 = (hi - r.org[a]) * r.inv[a];
+            if (r.neg[a])
+                std::swap(t0, t1);
+            tn = max(t0, tn);
+            tf = min(t1, tf);
+        }
+        tnear[i] = tn;
+        mask |= (tn <= min(tf * SlabRobustScale, t_max)) << i;
+    }
+#endif
+    return mask & ((1 << node.nChildren) - 1);
+}
+
+template <int N>
+bool CompressedWideBVH<N>::hit(const ray &r, float t_min, float t_max,
+                               hit_record &rec) const {
+    if (nodes.empty())
+        return false;
+
+    traversal_ray tr(r);
+    struct Entry {
+        int child;
+        int count;
+        float t;
+    };
+    Entry stack[MaxStack];
+    int top = 0;
+    stack[top++] = {0, 0, t_min};
+    bool is_hit = false;
+    while (top > 0) {
+        Entry e = stack[--top];
+        if (e.t > t_max)
+            continue;
+        if (e.count > 0) {
+            BVH_COUNT(primitiveTests, e.count);
+            for (int i = 0; i < e.count; i++)
+                if (primitives[e.child + i]->hit(r, t_min, t_max, rec)) {
+                    is_hit = true;
+                    t_max = rec.t;
+                }
+            continue;
+        }
+
+        const CompressedWideBVHNode<N> &node = nodes[e.child];
+        BVH_COUNT(nodeVisits, 1);
+        BVH_TOUCH(&node);
+        alignas(16) float tnear[N];
+        int mask = intersect_children(node, tr, t_min, t_max, tnear);
+        int offsets[N];
+        child_offsets(node, offsets);
+
+        // 按进入距离从远到近入栈
+        int base = top;
+        while (mask) {
+            int i = __builtin_ctz(mask);
+            mask &= mask - 1;
+            Entry c = {offsets[i], node.count[i], tnear[i]};
+            int j = top++;
+            while (j > base && stack[j - 1].t < c.t) {
+                stack[j] = stack[j - 1];
+                j--;
+            }
+            stack[j] = c;
+        }
+    }
+    return is_hit;
+}
+
+template <int N>
+bool CompressedWideBVH<N>::occluded(const ray &r, float t_min,
+                                    float t_max) const {
+    if (nodes.empty())
+        return false;
+
+    traversal_ray tr(r);
+    int stack[MaxStack];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const CompressedWideBVHNode<N> &node = nodes[stack[--top]];
+        BVH_COUNT(nodeVisits, 1);
+        BVH_TOUCH(&node);
+        alignas(16) float tnear[N];
+        int mask = intersect_children(node, tr, t_min, t_max, tnear);
+        int offsets[N];
+        child_offsets(node, offsets);
+        while (mask) {
+            int i = __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (node.count[i] == 0) {
+                stack[top++] = offsets[i];
+                continue;
+            }
+            BVH_COUNT(primitiveTests, node.count[i]);
+            for (int k = 0; k < node.count[i]; k++)
+                if (primitives[offsets[i] + k]->occluded(r, t_min, t_max))
+                    return true;
+        }
+    }
+    return false;
+}
+
+template <int N>
+void CompressedWideBVH<N>::all_hits(const ray &r, float t_min, float t_max,
+                                    hit_collector &out) const {
+    if (nodes.empty())
+        return;
+
+    traversal_ray tr(r);
+    int stack[MaxStack];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const CompressedWideBVHNode<N> &node = nodes[stack[--top]];
+        BVH_COUNT(nodeVisits, 1);
+        BVH_TOUCH(&node);
+        alignas(16) float tnear[N];
+        int mask =
+            intersect_children(node, tr, t_min, out.bound(t_max), tnear);
+        int offsets[N];
+        child_offsets(node, offsets);
+        while (mask) {
+            int i = __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (node.count[i] == 0) {
+                stack[top++] = offsets[i];
+                continue;
+            }
+            BVH_COUNT(primitiveTests, node.count[i]);
+            for (int k = 0; k < node.count[i]; k++)
+                primitives[offsets[i] + k]->all_hits(r, t_min,
+                                                     out.bound(t_max), out);
+        }
+    }
+}
+
+// 构建二叉 BVH, 塌缩成 N 叉后再量化
+template <int N>
+shared_ptr<CompressedWideBVH<N>>
+build_compressed_bvh(hittableList &list, double time0, double time1,
+                     const BVHBuildOptions &opts = BVHBuildOptions()) {
+    return make_shared<CompressedWideBVH<N>>(
+        *build_wide_bvh<N>(list, time0, time1, opts));
+}
+
+#endif // RAYTRACE_COMPRESSEDBVH_HPP
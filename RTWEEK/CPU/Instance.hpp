@@ -0,0 +1,174 @@
+#ifndef RAYTRACE_INSTANCE_HPP
+#define RAYTRACE_INSTANCE_HPP
+
+#include "./AABB.hpp"
+#include "./externalTools.hpp"
+#include "./hittable.hpp"
+#include "./ray.hpp"
+#include "./vec3.hpp"
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+using namespace std;
+
+// 3x4 仿射变换, 前三列为线性部分, 最后一列为平移
+struct affine3 {
+    double m[3][4];
+
+    static affine3 identity() {
+        return {{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}}};
+    }
+    static affine3 translation(const vec3 &offset) {
+        affine3 a = identity();
+        for (int i = 0; i < 3; i++)
+            a.m[i][3] = offset[i];
+        return a;
+    }
+    static affine3 scaling(const vec3 &s) {
+        affine3 a = identity();
+        for (int i = 0; i < 3; i++)
+            a.m[i][i] = s[i];
+        return a;
+    }
+    // 与 rotate_y 的方向一致
+    static affine3 rotation_y(double angle) {
+        double s = sin(degrees_to_radians(angle));
+        double c = cos(degrees_to_radians(angle));
+        return {{{c, 0, s, 0}, {0, 1, 0, 0}, {-s, 0, c, 0}}};
+    }
+
+    vec3 point(const vec3 &p) const {
+        return vec3(
+            m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3],
+            m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3],
+            m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3]);
+    }
+    vec3 direction(const vec3 &v) const {
+        return vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+                    m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+                    m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+    }
+    // 乘线性部分的转置, 以逆变换调用即得法线的变换 (逆的转置)
+    vec3 transposed_direction(const vec3 &v) const {
+        return vec3(m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2],
+                    m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2],
+                    m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2]);
+    }
+
+    affine3 inverse() const;
+};
+
+// 先做 b 再做 a
+inline affine3 operator*(const affine3 &a, const affine3 &b) {
+    affine3 r;
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 4; j++) {
+            r.m[i][j] = (j == 3 ? a.m[i][3] : 0);
+            for (int k = 0; k < 3; k++)
+                r.m[i][j] += a.m[i][k] * b.m[k][j];
+        }
+    return r;
+}
+
+// 线性部分用伴随矩阵求逆, 平移为 -A^-1 t
+affine3 affine3::inverse() const {
+    double c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+    double c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+    double c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+    double det = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+    if (fabs(det) < DBL_MIN) {
+        std::cerr << "Singular transform in affine3::inverse.\n";
+        return identity();
+    }
+    double inv_det = 1.0 / det;
+    affine3 r;
+    r.m[0][0] = c00 * inv_det;
+    r.m[1][0] = c01 * inv_det;
+    r.m[2][0] = c02 * inv_det;
+    r.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+    r.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+    r.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+    r.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+    r.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+    r.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+    vec3 t = r.direction(vec3(m[0][3], m[1][3], m[2][3]));
+    for (int i = 0; i < 3; i++)
+        r.m[i][3] = -t[i];
+    return r;
+}
+
+// 几何体的一次摆放
+// blas 是底层加速结构 (通常为某个几何体只建一次的 BVH), 多个实例共享同一份;
+// 实例本身作为物体放进顶层 BVH, 光线进入实例时只变换一次到物体空间
+// 方向不归一化, 所以两个空间中的 t 相同, 不需要换算 t_min/t_max
+class instance : public hittable {
+public:
+    instance(shared_ptr<hittable> blas, const affine3 &to_world);
+
+    virtual bool hit(const ray &r, float t_min, float t_max,
+                     hit_record &rec) const override;
+    virtual bool occluded(const ray &r, float t_min,
+                          float t_max) const override {
+        return blas->occluded(to_object(r), t_min, t_max);
+    }
+    virtual void all_hits(const ray &r, float t_min, float t_max,
+                          hit_collector &out) const override {
+        blas->all_hits(to_object(r), t_min, t_max, out);
+    }
+    virtual bool bounding_box(float t0, float t1,
+                              AABB &output_box) const override;
+
+    ray to_object(const ray &r) const {
+        return ray(world_to_object.point(r.origin()),
+                   world_to_object.direction(r.direction()), r.time());
+    }
+
+public:
+    shared_ptr<hittable> blas;
+    affine3 object_to_world;
+    affine3 world_to_object; // 构造时求逆并缓存
+
+private:
+    bool hasbox;
+    AABB bbox; // 世界空间包围盒
+};
+
+instance::instance(shared_ptr<hittable> blas, const affine3 &to_world)
+    : blas(blas), object_to_world(to_world),
+      world_to_object(to_world.inverse()) {
+    AABB box;
+    hasbox = blas->bounding_box(0, 1, box);
+    if (!hasbox)
+        return;
+    // 变换物体空间包围盒的 8 个角点
+    vec3 lo(DBL_MAX, DBL_MAX, DBL_MAX), hi(-DBL_MAX, -DBL_MAX, -DBL_MAX);
+    for (int i = 0; i < 8; i++) {
+        vec3 corner((i & 1 ? box.max() : box.min()).x(),
+                    (i & 2 ? box.max() : box.min()).y(),
+                    (i & 4 ? box.max() : box.min()).z());
+        vec3 p = object_to_world.point(corner);
+        for (int a = 0; a < 3; a++) {
+            lo[a] = fmin(lo[a], p[a]);
+            hi[a] = fmax(hi[a], p[a]);
+        }
+    }
+    bbox = AABB(lo, hi);
+}
+
+bool instance::bounding_box(float t0, float t1, AABB &output_box) const {
+    output_box = bbox;
+    return hasbox;
+}
+
+bool instance::hit(const ray &r, float t_min, float t_max,
+                   hit_record &rec) const {
+    if (!blas->hit(to_object(r), t_min, t_max, rec))
+        return false;
+    // 仿射变换保持方向与法线点积的符号, front_face 不变;
+    // 法线按逆变换的转置变换, 有缩放时重新归一化
+    rec.p = object_to_world.point(rec.p);
+    rec.normal = unit_vector(world_to_object.transposed_direction(rec.normal));
+    return true;
+}
+
+#endif // RAYTRACE_INSTANCE_HPP
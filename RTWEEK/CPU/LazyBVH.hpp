@@ -0,0 +1,358 @@
+#ifndef RAYTRACE_LAZYBVH_HPP
+#define RAYTRACE_LAZYBVH_HPP
+
+#include "./AABB.hpp"
+#include "./BVHBuilder.hpp"
+#include "./LinearBVH.hpp"
+#include "./hittable.hpp"
+#include "./ray.hpp"
+#include "./vec3.hpp"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// 按需构建的 BVH, 用于大场景的交互预览
+// 只对上层做分桶 SAH 划分, 物体数不超过 lazySubtreeSize 的子树先不建,
+// 记下物体区间; 第一次有光线进入该子树时才用 SAHBuilder 建出完整的 LinearBVH
+// 每个子树一个 once_flag: 同时到达的线程等待第一个线程建完, 不会重复构建;
+// 构建线程在渲染的并行区域内时 OpenMP 不再嵌套, 等于单线程构建
+// 低采样数下光线只进入少数子树, 出第一个像素前几乎不需要构建
+class LazyBVH : public hittable {
+public:
+    static const int MaxDepth = LinearBVH::MaxDepth;
+    // 上层节点的 axis 取该值表示延迟子树, primitivesOffset 为子树下标
+    static const uint8_t LazyLeaf = 3;
+
+    LazyBVH(hittableList &list, double time0, double time1,
+            const BVHBuildOptions &opts = BVHBuildOptions());
+
+    virtual bool hit(const ray &r, float t_min, float t_max,
+                     hit_record &rec) const override;
+    virtual bool occluded(const ray &r, float t_min,
+                          float t_max) const override;
+    virtual void all_hits(const ray &r, float t_min, float t_max,
+                          hit_collector &out) const override;
+    virtual bool bounding_box(float t0, float t1,
+                              AABB &output_box) const override;
+
+    // 已建成的子树数, 用于统计
+    int built() const { return n_built.load(memory_order_relaxed); }
+    int subtree_count() const { return subtrees.size(); }
+
+    // 建出所有尚未构建的子树, 例如预览结束后转入最终渲染时
+    void build_all() const {
+#pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < (int)subtrees.size(); i++)
+            subtree(i);
+    }
+
+    vector<LinearBVHNode> nodes; // 上层节点, 深度优先顺序
+    vector<shared_ptr<hittable>> primitives;
+
+private:
+    struct Subtree {
+        int start = 0, end = 0; // 在 primitives 中的区间
+        once_flag once;
+        shared_ptr<LinearBVH> bvh;
+    };
+
+    void build_upper(vector<BVHPrimitiveInfo> &info, int start, int end,
+                     const AABB &bounds, const AABB &centroid_bounds,
+                     int depth, vector<pair<int, int>> &ranges);
+    const LinearBVH &subtree(int index) const;
+    template <typename F>
+    void traverse(const ray &r, float t_min, const float &t_max, bool ordered,
+                  F on_subtree) const;
+
+    double time0, time1;
+    BVHBuildOptions opts;
+    // 子树在 const 的求交中构建
+    mutable vector<Subtree> subtrees;
+    mutable atomic<int> n_built{0};
+};
+
+LazyBVH::LazyBVH(hittableList &list, double time0, double time1,
+                 const BVHBuildOptions &opts)
+    : time0(time0), time1(time1), opts(opts) {
+    auto info =
+        primitive_info(list.objects, time0, time1, build_threads(opts));
+    if (info.empty())
+        return;
+    AABB bounds = empty_box(), centroid_bounds = empty_box();
+    for (const auto &p : info) {
+        bounds = surrounding_box(bounds, p.box);
+        centroid_bounds =
+            surrounding_box(centroid_bounds, AABB(p.centroid, p.centroid));
+    }
+    vector<pair<int, int>> ranges;
+    build_upper(info, 0, info.size(), bounds, centroid_bounds, 0, ranges);
+
+    // once_flag 不能移动, 子树数组一次性构造
+    subtrees = vector<Subtree>(ranges.size());
+    for (int i = 0; i < (int)ranges.size(); i++) {
+        subtrees[i].start = ranges[i].first;
+        subtrees[i].end = ranges[i].second;
+    }
+    primitives.resize(info.size());
+    for (int i = 0; i < (int)info.size(); i++)
+        primitives[i] = list.objects[info[i].index];
+}
+
+// 上层的串行分桶 SAH, 直接按深度优先顺序输出
+// 分桶时同时累积各桶的质心范围, 孩子的包围盒与质心范围由桶合并得到,
+// 每层只扫描一遍区间, 总代价 O(n * 上层深度)
+// 子树各自遍历, 只有上层受遍历栈深度的限制: 把每个延迟子树看作一个物体,
+// 深度接近上限时按质心中位数对半分
+void LazyBVH::build_upper(vector<BVHPrimitiveInfo> &info, int start, int end,
+                          const AABB &bounds, const AABB &centroid_bounds,
+                          int depth, vector<pair<int, int>> &ranges) {
+    int index = nodes.size();
+    nodes.emplace_back();
+    nodes[index].set_bounds(bounds);
+    nodes[index].pad = 0;
+
+    int n = end - start;
+    int subtree_size = max(opts.lazySubtreeSize, 1);
+    if (n <= subtree_size) {
+        nodes[index].primitivesOffset = ranges.size();
+        nodes[index].nPrimitives = 0;
+        nodes[index].axis = LazyLeaf;
+        ranges.push_back({start, end});
+        return;
+    }
+    bool limited =
+        bvh_depth_limited(depth, (n + subtree_size - 1) / subtree_size);
+
+    vec3 extent = centroid_bounds.max() - centroid_bounds.min();
+    int dim = 0;
+    if (extent[1] > extent[dim])
+        dim = 1;
+    if (extent[2] > extent[dim])
+        dim = 2;
+
+    // 分桶是上层构建的热点, 直接在 double 数组上取最值
+    struct Bucket {
+        int count = 0;
+        double lo[3] = {DBL_MAX, DBL_MAX, DBL_MAX};
+        double hi[3] = {-DBL_MAX, -DBL_MAX, -DBL_MAX};
+        double clo[3] = {DBL_MAX, DBL_MAX, DBL_MAX};
+        double chi[3] = {-DBL_MAX, -DBL_MAX, -DBL_MAX};
+
+        AABB box() const {
+            return AABB(vec3(lo[0], lo[1], lo[2]), vec3(hi[0], hi[1], hi[2]));
+        }
+        AABB centroids() const {
+            return AABB(vec3(clo[0], clo[1], clo[2]),
+                        vec3(chi[0], chi[1], chi[2]));
+        }
+    };
+    const int MaxBuckets = SAHBuilder::MaxBuckets;
+    Bucket buckets[MaxBuckets];
+    int nb = std::clamp(opts.nBuckets, 2, MaxBuckets);
+    double cmin = centroid_bounds.min()[dim];
+    auto bucket_of = [&](const vec3 &c) {
+        int b = nb * ((c[dim] - cmin) / extent[dim]);
+        return b >= nb ? nb - 1 : b;
+    };
+
+    int mid = -1, min_bucket = -1;
+    if (extent[dim] > 0 && !limited) {
+        for (int i = start; i < end; i++) {
+            const BVHPrimitiveInfo &p = info[i];
+            Bucket &b = buckets[bucket_of(p.centroid)];
+            b.count++;
+            for (int a = 0; a < 3; a++) {
+                b.lo[a] = std::min(b.lo[a], p.box.min()[a]);
+                b.hi[a] = std::max(b.hi[a], p.box.max()[a]);
+                b.clo[a] = std::min(b.clo[a], p.centroid[a]);
+                b.chi[a] = std::max(b.chi[a], p.centroid[a]);
+            }
+        }
+
+        double right_area[MaxBuckets];
+        int right_count[MaxBuckets];
+        AABB acc = empty_box();
+        int c = 0;
+        for (int i = nb - 1; i > 0; i--) {
+            acc = surrounding_box(acc, buckets[i].box());
+            c += buckets[i].count;
+            right_area[i] = c ? acc.surface_area() : 0;
+            right_count[i] = c;
+        }
+        double min_cost = DBL_MAX;
+        acc = empty_box();
+        c = 0;
+        for (int i = 0; i < nb - 1; i++) {
+            acc = surrounding_box(acc, buckets[i].box());
+            c += buckets[i].count;
+            if (c == 0 || right_count[i + 1] == 0)
+                continue;
+            double cost = c * acc.surface_area() +
+                          right_count[i + 1] * right_area[i + 1];
+            if (cost < min_cost) {
+                min_cost = cost;
+                min_bucket = i;
+            }
+        }
+        if (min_bucket >= 0)
+            mid = std::partition(info.begin() + start, info.begin() + end,
+                                 [&](const BVHPrimitiveInfo &p) {
+                                     return bucket_of(p.centroid) <=
+                                            min_bucket;
+                                 }) -
+                  info.begin();
+    }
+
+    AABB child_bounds[2], child_centroids[2];
+    if (mid > start && mid < end) {
+        for (int k = 0; k < 2; k++) {
+            child_bounds[k] = empty_box();
+            child_centroids[k] = empty_box();
+        }
+        for (int i = 0; i < nb; i++) {
+            int k = i > min_bucket;
+            child_bounds[k] =
+                surrounding_box(child_bounds[k], buckets[i].box());
+            child_centroids[k] =
+                surrounding_box(child_centroids[k], buckets[i].centroids());
+        }
+    } else if (limited && extent[dim] > 0) {
+        mid = (start + end) / 2;
+        std::nth_element(info.begin() + start, info.begin() + mid,
+                         info.begin() + end,
+                         [dim](const BVHPrimitiveInfo &a,
+                               const BVHPrimitiveInfo &b) {
+                             return a.centroid[dim] < b.centroid[dim];
+                         });
+        for (int k = 0; k < 2; k++) {
+            child_bounds[k] = empty_box();
+            child_centroids[k] = empty_box();
+        }
+        for (int i = start; i < end; i++) {
+            int k = i >= mid;
+            const BVHPrimitiveInfo &p = info[i];
+            child_bounds[k] = surrounding_box(child_bounds[k], p.box);
+            child_centroids[k] = surrounding_box(
+                child_centroids[k], AABB(p.centroid, p.centroid));
+        }
+    } else {
+        // 质心重合时按个数对半分, 两半的范围与父节点相同
+        mid = (start + end) / 2;
+        child_bounds[0] = child_bounds[1] = bounds;
+        child_centroids[0] = child_centroids[1] = centroid_bounds;
+    }
+
+    build_upper(info, start, mid, child_bounds[0], child_centroids[0],
+                depth + 1, ranges);
+    nodes[index].secondChildOffset = nodes.size();
+    nodes[index].nPrimitives = 0;
+    nodes[index].axis = dim;
+    build_upper(info, mid, end, child_bounds[1], child_centroids[1],
+                depth + 1, ranges);
+}
+
+// 第一次访问时构建, 之后 call_once 只读一次标志
+const LinearBVH &LazyBVH::subtree(int index) const {
+    Subtree &s = subtrees[index];
+    call_once(s.once, [&]() {
+        auto bvh = make_shared<LinearBVH>();
+        vector<shared_ptr<hittable>> objects(primitives.begin() + s.start,
+                                             primitives.begin() + s.end);
+        SAHBuilder(opts).build(objects, time0, time1, *bvh);
+        s.bvh = bvh;
+        n_built.fetch_add(1, memory_order_relaxed);
+    });
+    return *s.bvh;
+}
+
+bool LazyBVH::bounding_box(float t0, float t1, AABB &output_box) const {
+    if (nodes.empty())
+        return false;
+    const LinearBVHNode &root = nodes[0];
+    output_box = AABB(vec3(root.bounds[0][0], root.bounds[0][1],
+                           root.bounds[0][2]),
+                      vec3(root.bounds[1][0], root.bounds[1][1],
+                           root.bounds[1][2]));
+    return true;
+}
+
+// 与 LinearBVH 相同的上层遍历, 到达延迟子树时交给 on_subtree;
+// on_subtree 返回 true 时结束遍历
+template <typename F>
+void LazyBVH::traverse(const ray &r, float t_min, const float &t_max,
+                       bool ordered, F on_subtree) const {
+    traversal_ray tr(r);
+    int stack[MaxDepth];
+    int top = 0, current = 0;
+    while (true) {
+        const LinearBVHNode &node = nodes[current];
+        BVH_COUNT(nodeVisits, 1);
+        BVH_TOUCH(&node);
+        if (node.hit(tr, t_min, t_max)) {
+            if (node.axis == LazyLeaf) {
+                if (on_subtree(subtree(node.primitivesOffset)))
+                    return;
+            } else if (ordered && tr.neg[node.axis]) {
+                stack[top++] = current + 1;
+                current = node.secondChildOffset;
+                continue;
+            } else {
+                stack[top++] = node.secondChildOffset;
+                current = current + 1;
+                continue;
+            }
+        }
+        if (top == 0)
+            break;
+        current = stack[--top];
+    }
+}
+
+bool LazyBVH::hit(const ray &r, float t_min, float t_max,
+                  hit_record &rec) const {
+    if (nodes.empty())
+        return false;
+    bool is_hit = false;
+    traverse(r, t_min, t_max, true, [&](const LinearBVH &sub) {
+        if (sub.hit(r, t_min, t_max, rec)) {
+            is_hit = true;
+            t_max = rec.t;
+        }
+        return false;
+    });
+    return is_hit;
+}
+
+bool LazyBVH::occluded(const ray &r, float t_min, float t_max) const {
+    if (nodes.empty())
+        return false;
+    bool blocked = false;
+    traverse(r, t_min, t_max, false, [&](const LinearBVH &sub) {
+        return blocked = sub.occluded(r, t_min, t_max);
+    });
+    return blocked;
+}
+
+void LazyBVH::all_hits(const ray &r, float t_min, float t_max,
+                       hit_collector &out) const {
+    if (nodes.empty())
+        return;
+    float bound = out.bound(t_max);
+    traverse(r, t_min, bound, false, [&](const LinearBVH &sub) {
+        sub.all_hits(r, t_min, bound, out);
+        bound = out.bound(t_max);
+        return false;
+    });
+}
+
+// 只建上层, 其余子树在第一次被访问时构建
+shared_ptr<LazyBVH>
+build_lazy_bvh(hittableList &list, double time0, double time1,
+               const BVHBuildOptions &opts = BVHBuildOptions()) {
+    return make_shared<LazyBVH>(list, time0, time1, opts);
+}
+
+#endif // RAYTRACE_LAZYBVH_HPP
@@ -0,0 +1,505 @@
+#ifndef RAYTRACE_LINEARBVH_HPP
+#define RAYTRACE_LINEARBVH_HPP
+
+#include "./AABB.hpp"
+#include "./BVH.hpp"
+#include "./hittable.hpp"
+#include "./ray.hpp"
+#include "./vec3.hpp"
+#include "omp.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+using namespace std;
+
+// 32 字节的线性 BVH 节点, 两个节点正好占一条缓存行
+struct alignas(32) LinearBVHNode {
+    float bounds[2][3]; // [0]: 最小点 [1]: 最大点, 向外取整保证保守
+    union {
+        int primitivesOffset;  // 叶子: 第一个物体在 primitives 中的下标
+        int secondChildOffset; // 内部节点: 第二个孩子的下标, 第一个孩子紧随其后
+    };
+    uint16_t nPrimitives; // 0 表示内部节点
+    uint8_t axis;         // 内部节点的划分轴
+    uint8_t pad;
+
+    void set_bounds(const AABB &box);
+
+    // 光线与节点包围盒相交, 且进入点不远于 tmax
+    inline bool hit(const traversal_ray &r, float tmin, float tmax) const {
+        return slab_hit(&bounds[0][0], r, tmin, tmax);
+    }
+};
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode must be 32 bytes");
+
+void LinearBVHNode::set_bounds(const AABB &box) {
+    for (int a = 0; a < 3; a++) {
+        bounds[0][a] = round_down(box.min()[a]);
+        bounds[1][a] = round_up(box.max()[a]);
+    }
+}
+
+// 节点包围盒的表面积
+inline double node_area(const LinearBVHNode &node) {
+    double dx = node.bounds[1][0] - node.bounds[0][0];
+    double dy = node.bounds[1][1] - node.bounds[0][1];
+    double dz = node.bounds[1][2] - node.bounds[0][2];
+    return 2.0 * (dx * dy + dx * dz + dy * dz);
+}
+
+// 遍历计数, 只在定义 BVH_STATS 时统计, 默认不影响热路径
+struct BVHCounters {
+    uint64_t nodeVisits = 0;
+    uint64_t primitiveTests = 0;
+    uint64_t lineMisses = 0; // 节点访问在 BVHCacheModel 中的缓存行缺失
+    uint64_t pageMisses = 0; // 节点访问在 BVHCacheModel 中的页缺失
+};
+inline BVHCounters &bvh_counters() {
+    static thread_local BVHCounters counters;
+    return counters;
+}
+
+// 比较节点布局用的简化缓存模型, 硬件计数器不可用时也能统计:
+// 32KB 8 路组相联的数据缓存和 64 项 4 路组相联的页表缓存, LRU 替换,
+// 只模拟节点本身的访问; 状态跨光线保留, 与真实缓存一样
+struct BVHCacheModel {
+    static const int Sets = 64, Ways = 8;
+    static const int PageSets = 16, PageWays = 4;
+    uint64_t lines[Sets][Ways] = {}; // 存放行号 + 1, 0 表示空
+    uint64_t pages[PageSets][PageWays] = {};
+
+    // 命中时移到最前, 缺失时替换最后一项
+    template <int W> static bool access(uint64_t *set, uint64_t tag) {
+        int i = 0;
+        while (i < W - 1 && set[i] != tag)
+            i++;
+        bool found = set[i] == tag;
+        for (; i > 0; i--)
+            set[i] = set[i - 1];
+        set[0] = tag;
+        return found;
+    }
+    void touch(const void *p, BVHCounters &counters) {
+        uint64_t line = (uint64_t)p >> 6, page = (uint64_t)p >> 12;
+        if (!access<Ways>(lines[line % Sets], line + 1))
+            counters.lineMisses++;
+        if (!access<PageWays>(pages[page % PageSets], page + 1))
+            counters.pageMisses++;
+    }
+};
+// 访问 [p, p + bytes) 覆盖的每条缓存行, 宽节点会跨越多条
+inline void bvh_touch(const void *p, size_t bytes) {
+    static thread_local BVHCacheModel model;
+    uintptr_t first = (uintptr_t)p >> 6, last = ((uintptr_t)p + bytes - 1) >> 6;
+    for (uintptr_t line = first; line <= last; line++)
+        model.touch((const void *)(line << 6), bvh_counters());
+}
+
+#ifdef BVH_STATS
+#define BVH_COUNT(field, n) (bvh_counters().field += (n))
+#define BVH_TOUCH(p) bvh_touch(p, sizeof(*(p)))
+#else
+#define BVH_COUNT(field, n)
+#define BVH_TOUCH(p)
+#endif
+
+// 构建统计, 便于比较不同构建方式
+struct BVHBuildStats {
+    double buildTime = 0; // 秒
+    double sahCost = 0;   // 整棵树的 SAH 代价, 以根节点面积归一化
+    int nodes = 0;
+    int leaves = 0;
+    int maxDepth = 0;
+    double buildSahCost = 0; // 最近一次构建时的 SAH 代价, 衡量 refit 后的退化
+    double refitTime = 0;    // 最近一次 refit 的耗时, 秒
+    int references = 0;      // 叶子中的物体引用数, SBVH 会复制引用
+    double duplication = 1;  // 引用数与物体数之比
+};
+
+// 深度优先展开到连续数组中的 BVH
+// 遍历用显式栈代替虚函数递归, 按光线方向先访问近的孩子,
+// 并用当前最近交点距离剔除更远的子树
+class LinearBVH : public hittable {
+public:
+    static const int MaxDepth = 64;
+
+    LinearBVH() = default;
+    LinearBVH(hittableList &list, double time0, double time1)
+        : LinearBVH(make_shared<BVHNode>(list, time0, time1), time0, time1) {}
+    LinearBVH(const shared_ptr<BVHNode> &root, double time0, double time1);
+
+    virtual bool hit(const ray &r, float t_min, float t_max,
+                     hit_record &rec) const override;
+    virtual bool occluded(const ray &r, float t_min,
+                          float t_max) const override;
+    virtual void all_hits(const ray &r, float t_min, float t_max,
+                          hit_collector &out) const override;
+    virtual bool bounding_box(float t0, float t1,
+                              AABB &output_box) const override;
+
+    // 按给定的遍历/求交代价计算 SAH 代价, 并更新 stats
+    double sah_cost(float traversalCost = 1, float intersectCost = 1);
+
+    // 物体移动后按原有拓扑自底向上重算包围盒, 子树足够大时并行,
+    // 返回 refit 后与构建时的 SAH 代价之比
+    double refit(double time0, double time1, int threads = 0,
+                 float traversalCost = 1, float intersectCost = 1);
+
+    vector<LinearBVHNode> nodes;
+    vector<shared_ptr<hittable>> primitives;
+    BVHBuildStats stats;
+
+protected:
+    int flatten(const shared_ptr<hittable> &obj, int depth);
+    int flatten_median(vector<shared_ptr<hittable>> &objects, int start,
+                       int end, int depth);
+    void refit_node(int index, int subtree_size, double time0, double time1);
+
+    double time0 = 0, time1 = 0;
+};
+
+// 遍历栈有 MaxDepth 项, 叶子最深只能在 MaxDepth - 1 层
+// 从 depth 层起一直按个数对半分, n 个物体的子树最深的叶子在
+// depth + ceil(log2 n) 层; 构建器在该值到达上限时改用中位数划分,
+// 此后深度加一、ceil(log2 n) 减一, 任意输入都不会超过上限
+inline bool bvh_depth_limited(int depth, int n) {
+    int levels = 0;
+    while (levels < 32 && ((int64_t)1 << levels) < n)
+        levels++;
+    return depth + levels >= LinearBVH::MaxDepth - 1;
+}
+
+// obj 子树中的物体数, 超过 limit 时提前返回
+inline int bvh_node_count(const shared_ptr<hittable> &obj, int limit) {
+    auto node = dynamic_pointer_cast<BVHNode>(obj);
+    if (!node || !node->left)
+        return 1;
+    if (node->left == node->right)
+        return bvh_node_count(node->left, limit);
+    int left = bvh_node_count(node->left, limit);
+    return left > limit ? left : left + bvh_node_count(node->right, limit);
+}
+
+// 收集 obj 子树中的物体
+inline void bvh_node_objects(const shared_ptr<hittable> &obj,
+                             vector<shared_ptr<hittable>> &out) {
+    auto node = dynamic_pointer_cast<BVHNode>(obj);
+    if (!node || !node->left) {
+        out.push_back(obj);
+        return;
+    }
+    bvh_node_objects(node->left, out);
+    if (node->right != node->left)
+        bvh_node_objects(node->right, out);
+}
+
+LinearBVH::LinearBVH(const shared_ptr<BVHNode> &root, double time0,
+                     double time1)
+    : time0(time0), time1(time1) {
+    if (root && root->left)
+        flatten(root, 0);
+    sah_cost();
+    stats.buildSahCost = stats.sahCost;
+}
+
+double LinearBVH::sah_cost(float traversalCost, float intersectCost) {
+    stats.nodes = nodes.size();
+    stats.leaves = 0;
+    stats.references = 0;
+    stats.sahCost = 0;
+    if (nodes.empty())
+        return 0;
+    double root_area = node_area(nodes[0]);
+    for (const auto &node : nodes) {
+        double area = root_area > 0 ? node_area(node) / root_area : 1.0;
+        if (node.nPrimitives > 0) {
+            stats.leaves++;
+            stats.references += node.nPrimitives;
+            stats.sahCost += intersectCost * node.nPrimitives * area;
+        } else
+            stats.sahCost += traversalCost * area;
+    }
+    return stats.sahCost;
+}
+
+double LinearBVH::refit(double time0, double time1, int threads,
+                        float traversalCost, float intersectCost) {
+    if (nodes.empty())
+        return 1;
+    double start = omp_get_wtime();
+    if (threads <= 0)
+        threads = omp_get_max_threads();
+#pragma omp parallel num_threads(threads)
+#pragma omp single
+    refit_node(0, nodes.size(), time0, time1);
+    stats.refitTime = omp_get_wtime() - start;
+    sah_cost(traversalCost, intersectCost);
+    return stats.buildSahCost > 0 ? stats.sahCost / stats.buildSahCost : 1;
+}
+
+// 深度优先布局下子树占据连续区间: 左孩子子树为 [index + 1, second),
+// 右孩子子树为 [second, index + subtree_size)
+void LinearBVH::refit_node(int index, int subtree_size, double time0,
+                           double time1) {
+    LinearBVHNode &node = nodes[index];
+    if (node.nPrimitives > 0) {
+        AABB box, b;
+        primitives[node.primitivesOffset]->bounding_box(time0, time1, box);
+        for (int i = 1; i < node.nPrimitives; i++) {
+            primitives[node.primitivesOffset + i]->bounding_box(time0, time1,
+                                                                b);
+            box = surrounding_box(box, b);
+        }
+        node.set_bounds(box);
+        return;
+    }
+
+    int left = index + 1, right = node.secondChildOffset;
+    int left_size = right - left, right_size = index + subtree_size - right;
+    if (subtree_size >= 4096) {
+#pragma omp task
+        refit_node(left, left_size, time0, time1);
+        refit_node(right, right_size, time0, time1);
+#pragma omp taskwait
+    } else {
+        refit_node(left, left_size, time0, time1);
+        refit_node(right, right_size, time0, time1);
+    }
+    // 孩子的 float 包围盒已向外取整, 直接取并集
+    for (int a = 0; a < 3; a++) {
+        node.bounds[0][a] =
+            min(nodes[left].bounds[0][a], nodes[right].bounds[0][a]);
+        node.bounds[1][a] =
+            max(nodes[left].bounds[1][a], nodes[right].bounds[1][a]);
+    }
+}
+
+// 返回 obj 展开后的节点下标
+int LinearBVH::flatten(const shared_ptr<hittable> &obj, int depth) {
+    stats.maxDepth = max(stats.maxDepth, depth);
+
+    auto node = dynamic_pointer_cast<BVHNode>(obj);
+    // 单物体叶子 left == right, 只展开一次
+    if (node && node->left && node->left == node->right)
+        return flatten(node->left, depth);
+
+    // BVHNode 的划分可能任意不平衡, 接近遍历栈上限时按中位数重新划分;
+    // 物体数超过 2^32 时上限总会触发, 所以只在较深处才去数子树
+    if (node && node->left && depth >= MaxDepth - 1 - 32) {
+        int limit = 1 << min(MaxDepth - 1 - depth, 30);
+        if (bvh_depth_limited(depth, bvh_node_count(obj, limit))) {
+            vector<shared_ptr<hittable>> objects;
+            bvh_node_objects(obj, objects);
+            return flatten_median(objects, 0, objects.size(), depth);
+        }
+    }
+
+    int index = nodes.size();
+    nodes.emplace_back();
+    if (!node || !node->left) {
+        AABB box;
+        if (!obj->bounding_box(time0, time1, box))
+            std::cerr << "No bounding box in LinearBVH constructor.\n";
+        nodes[index].set_bounds(box);
+        nodes[index].primitivesOffset = primitives.size();
+        nodes[index].nPrimitives = 1;
+        nodes[index].axis = 0;
+        primitives.push_back(obj);
+        return index;
+    }
+
+    nodes[index].set_bounds(node->box);
+    // BVHNode 不记录划分轴, 取两孩子中心相距最远的轴,
+    // 并保证第一个孩子在该轴上更靠近负方向
+    AABB box_left, box_right;
+    node->left->bounding_box(time0, time1, box_left);
+    node->right->bounding_box(time0, time1, box_right);
+    vec3 delta = (box_right.min() + box_right.max()) -
+                 (box_left.min() + box_left.max());
+    int axis = 0;
+    for (int a = 1; a < 3; a++)
+        if (fabs(delta[a]) > fabs(delta[axis]))
+            axis = a;
+    bool swap_children = delta[axis] < 0;
+
+    flatten(swap_children ? node->right : node->left, depth + 1);
+    int second = flatten(swap_children ? node->left : node->right, depth + 1);
+    nodes[index].secondChildOffset = second;
+    nodes[index].nPrimitives = 0;
+    nodes[index].axis = axis;
+    return index;
+}
+
+// 把 objects[start, end) 按质心跨度最大的轴对半分, 直到单个物体
+int LinearBVH::flatten_median(vector<shared_ptr<hittable>> &objects,
+                              int start, int end, int depth) {
+    stats.maxDepth = max(stats.maxDepth, depth);
+    if (end - start == 1)
+        return flatten(objects[start], depth);
+
+    AABB box, bounds, centroids;
+    for (int i = start; i < end; i++) {
+        if (!objects[i]->bounding_box(time0, time1, box))
+            std::cerr << "No bounding box in LinearBVH constructor.\n";
+        vec3 c = 0.5 * (box.min() + box.max());
+        bounds = i == start ? box : surrounding_box(bounds, box);
+        centroids = i == start ? AABB(c, c)
+                               : surrounding_box(centroids, AABB(c, c));
+    }
+    vec3 extent = centroids.max() - centroids.min();
+    int axis = 0;
+    for (int a = 1; a < 3; a++)
+        if (extent[a] > extent[axis])
+            axis = a;
+    int mid = (start + end) / 2;
+    auto centroid = [&](const shared_ptr<hittable> &obj) {
+        obj->bounding_box(time0, time1, box);
+        return box.min()[axis] + box.max()[axis];
+    };
+    std::nth_element(objects.begin() + start, objects.begin() + mid,
+                     objects.begin() + end,
+                     [&](const shared_ptr<hittable> &a,
+                         const shared_ptr<hittable> &b) {
+                         return centroid(a) < centroid(b);
+                     });
+
+    int index = nodes.size();
+    nodes.emplace_back();
+    nodes[index].set_bounds(bounds);
+    flatten_median(objects, start, mid, depth + 1);
+    int second = flatten_median(objects, mid, end, depth + 1);
+    nodes[index].secondChildOffset = second;
+    nodes[index].nPrimitives = 0;
+    nodes[index].axis = axis;
+    return index;
+}
+
+bool LinearBVH::bounding_box(float t0, float t1, AABB &output_box) const {
+    if (nodes.empty())
+        return false;
+    const LinearBVHNode &root = nodes[0];
+    output_box = AABB(vec3(root.bounds[0][0], root.bounds[0][1],
+                           root.bounds[0][2]),
+                      vec3(root.bounds[1][0], root.bounds[1][1],
+                           root.bounds[1][2]));
+    return true;
+}
+
+bool LinearBVH::hit(const ray &r, float t_min, float t_max,
+                    hit_record &rec) const {
+    if (nodes.empty())
+        return false;
+
+    traversal_ray tr(r);
+
+    bool is_hit = false;
+    int stack[MaxDepth];
+    int top = 0, current = 0;
+    while (true) {
+        const LinearBVHNode &node = nodes[current];
+        BVH_COUNT(nodeVisits, 1);
+        BVH_TOUCH(&node);
+        if (node.hit(tr, t_min, t_max)) {
+            if (node.nPrimitives > 0) {
+                BVH_COUNT(primitiveTests, node.nPrimitives);
+                for (int i = 0; i < node.nPrimitives; i++)
+                    if (primitives[node.primitivesOffset + i]->hit(
+                            r, t_min, t_max, rec)) {
+                        is_hit = true;
+                        t_max = rec.t;
+                    }
+                if (top == 0)
+                    break;
+                current = stack[--top];
+            } else if (tr.neg[node.axis]) {
+                // 光线沿负方向, 先访问第二个孩子
+                stack[top++] = current + 1;
+                current = node.secondChildOffset;
+            } else {
+                stack[top++] = node.secondChildOffset;
+                current = current + 1;
+            }
+        } else {
+            if (top == 0)
+                break;
+            current = stack[--top];
+        }
+    }
+    return is_hit;
+}
+
+// 找到任意一个交点即返回, 不需要按远近顺序访问孩子
+bool LinearBVH::occluded(const ray &r, float t_min, float t_max) const {
+    if (nodes.empty())
+        return false;
+
+    traversal_ray tr(r);
+    int stack[MaxDepth];
+    int top = 0, current = 0;
+    while (true) {
+        const LinearBVHNode &node = nodes[current];
+        BVH_COUNT(nodeVisits, 1);
+        BVH_TOUCH(&node);
+        if (node.hit(tr, t_min, t_max)) {
+            if (node.nPrimitives > 0) {
+                BVH_COUNT(primitiveTests, node.nPrimitives);
+                for (int i = 0; i < node.nPrimitives; i++)
+                    if (primitives[node.primitivesOffset + i]->occluded(
+                            r, t_min, t_max))
+                        return true;
+                if (top == 0)
+                    break;
+                current = stack[--top];
+            } else {
+                stack[top++] = node.secondChildOffset;
+                current = current + 1;
+            }
+        } else {
+            if (top == 0)
+                break;
+            current = stack[--top];
+        }
+    }
+    return false;
+}
+
+// 与 hit 相同的近到远遍历, 收满 k 个交点后用第 k 个的距离剔除
+void LinearBVH::all_hits(const ray &r, float t_min, float t_max,
+                         hit_collector &out) const {
+    if (nodes.empty())
+        return;
+
+    traversal_ray tr(r);
+    int stack[MaxDepth];
+    int top = 0, current = 0;
+    while (true) {
+        const LinearBVHNode &node = nodes[current];
+        BVH_COUNT(nodeVisits, 1);
+        BVH_TOUCH(&node);
+        if (node.hit(tr, t_min, out.bound(t_max))) {
+            if (node.nPrimitives > 0) {
+                BVH_COUNT(primitiveTests, node.nPrimitives);
+                for (int i = 0; i < node.nPrimitives; i++)
+                    primitives[node.primitivesOffset + i]->all_hits(
+                        r, t_min, out.bound(t_max), out);
+                if (top == 0)
+                    break;
+                current = stack[--top];
+            } else if (tr.neg[node.axis]) {
+                stack[top++] = current + 1;
+                current = node.secondChildOffset;
+            } else {
+                stack[top++] = node.secondChildOffset;
+                current = current + 1;
+            }
+        } else {
+            if (top == 0)
+                break;
+            current = stack[--top];
+        }
+    }
+}
+
+#endif // RAYTRACE_LINEARBVH_HPP
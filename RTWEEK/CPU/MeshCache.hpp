@@ -0,0 +1,255 @@
+#ifndef RAYTRACE_MESHCACHE_HPP
+#define RAYTRACE_MESHCACHE_HPP
+
+#include "./BVHBuilder.hpp"
+#include "./LinearBVH.hpp"
+#include "./ObjLoader.hpp"
+#include "./TriangleBlock.hpp"
+#include "./TriangleMesh.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <vector>
+using namespace std;
+
+// 二进制网格缓存
+// 文件头之后依次是位置、法线、纹理坐标、索引, 以及可选的 BVH 节点与三角形块,
+// 每段按 64 字节对齐, 与内存中的布局完全相同; 读取时网格直接以视图使用
+// 映射的内存, 不复制也不解析, 映射随网格一起释放; 有 BVH 时检查偏移后
+// 直接使用, 不再构建
+// 写缓存先写临时文件再改名, 已映射旧缓存的网格不受影响
+// 文件头记下源文件的大小、修改时间与抽样哈希, 源文件变化后缓存自动失效;
+// 还记下各结构的大小, 结构布局改变后旧缓存同样失效
+
+// 源文件的指纹
+struct mesh_source_key {
+    uint64_t size = 0;
+    int64_t mtime = 0; // 纳秒
+    uint64_t hash = 0; // 开头、结尾与均匀分布的若干 4KB 块的 FNV-1a 哈希
+
+    bool operator==(const mesh_source_key &o) const {
+        return size == o.size && mtime == o.mtime && hash == o.hash;
+    }
+};
+
+// 只读取文件的一小部分, 大文件也只需几毫秒
+bool mesh_source_fingerprint(const string &path, mesh_source_key &key) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+    key.size = st.st_size;
+    key.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    mapped_file file(path);
+    if (!file.valid())
+        return false;
+    const size_t Block = 4096, Samples = 64;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    auto mix = [&](size_t offset, size_t bytes) {
+        for (size_t i = offset; i < offset + bytes; i++)
+            h = (h ^ (unsigned char)file.data()[i]) * 0x100000001b3ULL;
+    };
+    // 小文件整个哈希, 大文件取包括首尾在内的 Samples + 1 块
+    if (file.size() <= Block * (Samples + 1))
+        mix(0, file.size());
+    else
+        for (size_t k = 0; k <= Samples; k++)
+            mix((file.size() - Block) / Samples * k, Block);
+    key.hash = h;
+    return true;
+}
+
+struct MeshCacheHeader {
+    static const uint32_t Version = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t hasBvh;
+    mesh_source_key source;
+    // 结构大小, 布局不同的缓存不能直接复制
+    uint32_t vertexBytes, uvBytes, nodeBytes, blockBytes;
+    // 构建 BVH 时的方式与叶子上限, 与请求的不同时重建 BVH
+    int32_t bvhMethod, bvhMaxLeafSize;
+    // 位置、法线、纹理坐标、索引、BVH 节点、三角形块
+    uint64_t count[6];
+    uint64_t offset[6];
+};
+static_assert(sizeof(MeshCacheHeader) == 160, "mesh cache header has padding");
+
+namespace mesh_cache_detail {
+const char Magic[8] = {'R', 'T', 'M', 'E', 'S', 'H', '\0', '\0'};
+const size_t Align = 64;
+
+inline MeshCacheHeader make_header() {
+    MeshCacheHeader h = MeshCacheHeader();
+    memcpy(h.magic, Magic, sizeof(Magic));
+    h.version = MeshCacheHeader::Version;
+    h.vertexBytes = sizeof(point3);
+    h.uvBytes = sizeof(mesh_uv);
+    h.nodeBytes = sizeof(LinearBVHNode);
+    h.blockBytes = sizeof(TriangleBlock);
+    return h;
+}
+
+// 文件中的一段作为数组的视图, 映射按页对齐, 段的偏移也要满足 T 的对齐
+template <typename T>
+bool view_section(const mapped_file &file, const MeshCacheHeader &h, int k,
+                  mesh_array<T> &out) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "mesh cache sections must be trivially copyable");
+    uint64_t bytes = h.count[k] * sizeof(T);
+    if (h.count[k] > file.size() / sizeof(T) || h.offset[k] > file.size() ||
+        bytes > file.size() - h.offset[k] || h.offset[k] % alignof(T))
+        return false;
+    out = mesh_array<T>::view(
+        reinterpret_cast<const T *>(file.data() + h.offset[k]), h.count[k]);
+    return true;
+}
+} // namespace mesh_cache_detail
+
+// 写出网格缓存, with_bvh 为真时一并写出网格的 BVH
+bool write_mesh_cache(const string &path, const triangle_mesh &mesh,
+                      const mesh_source_key &source, bool with_bvh = true,
+                      const BVHBuildOptions &opts = BVHBuildOptions()) {
+    using namespace mesh_cache_detail;
+    MeshCacheHeader h = make_header();
+    h.source = source;
+    h.hasBvh = with_bvh;
+    h.bvhMethod = opts.method;
+    h.bvhMaxLeafSize = opts.maxLeafSize;
+    const void *data[6] = {mesh.positions.data(), mesh.normals.data(),
+                           mesh.uvs.data(), mesh.indices.data(),
+                           mesh.bvh_nodes().data(), mesh.bvh_blocks().data()};
+    uint64_t bytes[6] = {
+        mesh.positions.size() * sizeof(point3),
+        mesh.normals.size() * sizeof(vec3),
+        mesh.uvs.size() * sizeof(mesh_uv),
+        mesh.indices.size() * sizeof(uint32_t),
+        with_bvh ? mesh.bvh_nodes().size() * sizeof(LinearBVHNode) : 0,
+        with_bvh ? mesh.bvh_blocks().size() * sizeof(TriangleBlock) : 0};
+    uint64_t sizes[6] = {sizeof(point3),        sizeof(vec3),
+                         sizeof(mesh_uv),       sizeof(uint32_t),
+                         sizeof(LinearBVHNode), sizeof(TriangleBlock)};
+    uint64_t at = (sizeof(h) + Align - 1) / Align * Align;
+    for (int k = 0; k < 6; k++) {
+        h.count[k] = bytes[k] / sizes[k];
+        h.offset[k] = at;
+        at = (at + bytes[k] + Align - 1) / Align * Align;
+    }
+
+    // 先写临时文件再改名, 并发的读者不会看到写了一半的缓存
+    string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+        std::cerr << "Cannot write mesh cache " << path << ".\n";
+        return false;
+    }
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    static const char zeros[Align] = {0};
+    uint64_t written = sizeof(h);
+    for (int k = 0; k < 6 && ok; k++) {
+        ok = fwrite(zeros, 1, h.offset[k] - written, f) ==
+             h.offset[k] - written;
+        if (ok && bytes[k])
+            ok = fwrite(data[k], 1, bytes[k], f) == bytes[k];
+        written = h.offset[k] + bytes[k];
+    }
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        std::cerr << "Cannot write mesh cache " << path << ".\n";
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// 读取网格缓存; expected 不为空时检查源文件指纹, 不一致或文件损坏返回空指针
+// 缓存的 BVH 与 opts 的构建方式不同、没有 BVH 或偏移越界时, 用缓存的几何重建
+shared_ptr<triangle_mesh>
+read_mesh_cache(const string &path, shared_ptr<material> m,
+                const mesh_source_key *expected = nullptr,
+                const BVHBuildOptions &opts = BVHBuildOptions()) {
+    using namespace mesh_cache_detail;
+    auto file = make_shared<mapped_file>(path);
+    if (!file->valid() || file->size() < sizeof(MeshCacheHeader))
+        return nullptr;
+    MeshCacheHeader h;
+    memcpy(&h, file->data(), sizeof(h));
+    MeshCacheHeader ref = make_header();
+    if (memcmp(h.magic, ref.magic, sizeof(h.magic)) != 0 ||
+        h.version != ref.version || h.vertexBytes != ref.vertexBytes ||
+        h.uvBytes != ref.uvBytes || h.nodeBytes != ref.nodeBytes ||
+        h.blockBytes != ref.blockBytes)
+        return nullptr;
+    if (expected && !(h.source == *expected))
+        return nullptr;
+
+    mesh_array<point3> positions;
+    mesh_array<vec3> normals;
+    mesh_array<mesh_uv> uvs;
+    mesh_array<uint32_t> indices;
+    mesh_array<LinearBVHNode> nodes;
+    mesh_array<TriangleBlock> blocks;
+    if (!view_section(*file, h, 0, positions) ||
+        !view_section(*file, h, 1, normals) ||
+        !view_section(*file, h, 2, uvs) ||
+        !view_section(*file, h, 3, indices) ||
+        !view_section(*file, h, 4, nodes) ||
+        !view_section(*file, h, 5, blocks)) {
+        std::cerr << "Corrupt mesh cache " << path << ".\n";
+        return nullptr;
+    }
+    // 遍历按 BVH 随机访问, 不再按顺序预读
+    file->advise(MADV_NORMAL);
+    bool same_bvh = h.hasBvh && h.bvhMethod == opts.method &&
+                    h.bvhMaxLeafSize == opts.maxLeafSize && !nodes.empty();
+    if (!same_bvh) {
+        nodes = mesh_array<LinearBVHNode>();
+        blocks = mesh_array<TriangleBlock>();
+    }
+    auto mesh = make_shared<triangle_mesh>(positions, indices, m, normals, uvs,
+                                           nodes, blocks, file);
+    if (same_bvh && !mesh->bvh_valid()) {
+        std::cerr << "Invalid BVH in mesh cache " << path << ", rebuilding.\n";
+        same_bvh = false;
+    }
+    if (!same_bvh)
+        mesh->build(opts);
+    return mesh;
+}
+
+// 把 OBJ 转换为网格缓存, 同时建好 BVH
+bool convert_obj(const string &obj_path, const string &cache_path,
+                 const BVHBuildOptions &opts = BVHBuildOptions()) {
+    mesh_source_key key;
+    if (!mesh_source_fingerprint(obj_path, key)) {
+        std::cerr << "Cannot open OBJ file " << obj_path << ".\n";
+        return false;
+    }
+    auto mesh = load_obj(obj_path, nullptr, opts);
+    return mesh && write_mesh_cache(cache_path, *mesh, key, true, opts);
+}
+
+// 读取网格, 优先使用 OBJ 旁边的 .rtmesh 缓存; 缓存缺失或过期时重新读取并写回
+shared_ptr<triangle_mesh>
+load_mesh(const string &obj_path, shared_ptr<material> m,
+          const BVHBuildOptions &opts = BVHBuildOptions()) {
+    string cache_path = obj_path + ".rtmesh";
+    mesh_source_key key;
+    if (!mesh_source_fingerprint(obj_path, key)) {
+        std::cerr << "Cannot open OBJ file " << obj_path << ".\n";
+        return nullptr;
+    }
+    if (auto mesh = read_mesh_cache(cache_path, m, &key, opts))
+        return mesh;
+    auto mesh = load_obj(obj_path, m, opts);
+    if (mesh)
+        write_mesh_cache(cache_path, *mesh, key, true, opts);
+    return mesh;
+}
+
+#endif // RAYTRACE_MESHCACHE_HPP
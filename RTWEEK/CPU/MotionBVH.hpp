@@ -0,0 +1,531 @@
+#ifndef RAYTRACE_MOTIONBVH_HPP
+#define RAYTRACE_MOTIONBVH_HPP
+
+#include "./AABB.hpp"
+#include "./BVHBuilder.hpp"
+#include "./LinearBVH.hpp"
+#include "./hittable.hpp"
+#include "./ray.hpp"
+#include "./vec3.hpp"
+#include "omp.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+using namespace std;
+
+// 运动 BVH 节点, 记录节点时间区间两端的包围盒
+// 光线的包围盒按 r.time() 在两个关键帧之间线性插值, 对匀速运动的物体是精确的
+// 时间划分把区间对半分, 遍历时插值权重随路径更新, 节点里不必存时间区间
+struct alignas(64) MotionBVHNode {
+    float bounds[6]; // 区间起点处的 {min xyz, max xyz}
+    float motion[6]; // 区间终点减起点, 插值只需一次乘加
+    union {
+        int primitivesOffset;  // 叶子: 第一个物体在 primitives 中的下标
+        int secondChildOffset; // 内部节点: 第二个孩子的下标, 第一个孩子紧随其后
+    };
+    uint16_t nPrimitives; // 0 表示内部节点
+    uint8_t axis;         // 内部节点的划分轴, TimeSplit 表示按时间对半划分
+    uint8_t pad[9];
+
+    static const uint8_t TimeSplit = 3;
+
+    // w 为光线时刻在节点时间区间内的位置
+    inline bool hit(const traversal_ray &r, float w, float tmin,
+                    float tmax) const {
+        float b[6];
+        for (int i = 0; i < 6; i++)
+            b[i] = bounds[i] + w * motion[i];
+        return slab_hit(b, r, tmin, tmax);
+    }
+
+    // 区间端点 k 处的包围盒
+    AABB box(int k) const {
+        return AABB(vec3(bounds[0] + k * motion[0], bounds[1] + k * motion[1],
+                         bounds[2] + k * motion[2]),
+                    vec3(bounds[3] + k * motion[3], bounds[4] + k * motion[4],
+                         bounds[5] + k * motion[5]));
+    }
+};
+static_assert(sizeof(MotionBVHNode) == 64, "MotionBVHNode must be 64 bytes");
+
+// 时间区间上的运动包围盒: 两端的包围盒 box[0], box[1]
+struct MotionBounds {
+    AABB box[2];
+
+    MotionBounds() : box{empty_box(), empty_box()} {}
+
+    void expand(const MotionBounds &b) {
+        box[0] = surrounding_box(box[0], b.box[0]);
+        box[1] = surrounding_box(box[1], b.box[1]);
+    }
+
+    // 区间内插值包围盒的平均表面积
+    // 包围盒随时间线性变化, 面积是二次函数, Simpson 公式精确
+    double area() const {
+        AABB mid(0.5 * (box[0].min() + box[1].min()),
+                 0.5 * (box[0].max() + box[1].max()));
+        return (box[0].surface_area() + 4 * mid.surface_area() +
+                box[1].surface_area()) /
+               6;
+    }
+};
+
+// 质心取区间中点时刻的包围盒中心
+struct MotionPrimitiveInfo {
+    MotionBounds bounds;
+    vec3 centroid;
+    int index;
+};
+
+// 节点包围盒由关键帧包围盒逐物体取并集得到,
+// 并集的线性插值包含各物体插值包围盒的并集, 所以插值结果仍然保守
+// 物体在区间内的运动不是线性时插值可能偏小, 目前只有 moving_sphere 运动
+// 且为匀速, 时间划分也会缩小这一误差
+class MotionBVH : public hittable {
+public:
+    static const int MaxDepth = LinearBVH::MaxDepth;
+
+    MotionBVH() = default;
+
+    virtual bool hit(const ray &r, float t_min, float t_max,
+                     hit_record &rec) const override;
+    virtual bool occluded(const ray &r, float t_min,
+                          float t_max) const override;
+    virtual void all_hits(const ray &r, float t_min, float t_max,
+                          hit_collector &out) const override;
+    virtual bool bounding_box(float t0, float t1,
+                              AABB &output_box) const override;
+
+    double sah_cost(float traversalCost = 1, float intersectCost = 1);
+
+    vector<MotionBVHNode> nodes;
+    // 时间划分会把物体放进两个孩子, 同一物体可能出现多次
+    vector<shared_ptr<hittable>> primitives;
+    BVHBuildStats stats;
+    int timeSplits = 0; // 时间划分节点数
+    double time0 = 0, inv_duration = 0; // 根节点的时间区间
+
+private:
+    template <typename F>
+    void traverse(const ray &r, float t_min, const float &t_max, bool ordered,
+                  F on_leaf) const;
+};
+
+double MotionBVH::sah_cost(float traversalCost, float intersectCost) {
+    stats.nodes = nodes.size();
+    stats.leaves = 0;
+    stats.sahCost = 0;
+    if (nodes.empty())
+        return 0;
+    // 时间划分的孩子只被一半时刻的光线访问, 面积按所占区间比例加权
+    double root_area = 0;
+    auto accumulate = [&](auto &&self, int index, double fraction) -> void {
+        const MotionBVHNode &node = nodes[index];
+        MotionBounds b;
+        b.box[0] = node.box(0);
+        b.box[1] = node.box(1);
+        double area = b.area() * fraction;
+        if (index == 0)
+            root_area = area > 0 ? area : 1.0;
+        area /= root_area;
+        if (node.nPrimitives > 0) {
+            stats.leaves++;
+            stats.sahCost += intersectCost * node.nPrimitives * area;
+            return;
+        }
+        stats.sahCost += traversalCost * area;
+        double child = node.axis == MotionBVHNode::TimeSplit ? 0.5 : 1.0;
+        self(self, index + 1, fraction * child);
+        self(self, node.secondChildOffset, fraction * child);
+    };
+    accumulate(accumulate, 0, 1.0);
+    return stats.sahCost;
+}
+
+bool MotionBVH::bounding_box(float t0, float t1, AABB &output_box) const {
+    if (nodes.empty())
+        return false;
+    output_box = surrounding_box(nodes[0].box(0), nodes[0].box(1));
+    return true;
+}
+
+// 时间划分节点只访问光线时刻所在的孩子, 并把插值权重换算到孩子的半个区间;
+// 其余节点与父节点区间相同, 权重随栈一起保存
+// on_leaf 返回 true 时结束遍历; ordered 为真时按光线方向先访问近的孩子
+template <typename F>
+void MotionBVH::traverse(const ray &r, float t_min, const float &t_max,
+                         bool ordered, F on_leaf) const {
+    traversal_ray tr(r);
+    struct Entry {
+        int node;
+        float w;
+    };
+    Entry stack[MaxDepth];
+    int top = 0, current = 0;
+    float w = std::clamp(float((r.time() - time0) * inv_duration), 0.0f, 1.0f);
+    while (true) {
+        const MotionBVHNode &node = nodes[current];
+        BVH_COUNT(nodeVisits, 1);
+        if (node.hit(tr, w, t_min, t_max)) {
+            if (node.nPrimitives > 0) {
+                BVH_COUNT(primitiveTests, node.nPrimitives);
+                if (on_leaf(node))
+                    return;
+            } else if (node.axis == MotionBVHNode::TimeSplit) {
+                if (w < 0.5f) {
+                    current = current + 1;
+                    w = 2 * w;
+                } else {
+                    current = node.secondChildOffset;
+                    w = 2 * w - 1;
+                }
+                continue;
+            } else if (ordered && tr.neg[node.axis]) {
+                stack[top++] = {current + 1, w};
+                current = node.secondChildOffset;
+                continue;
+            } else {
+                stack[top++] = {node.secondChildOffset, w};
+                current = current + 1;
+                continue;
+            }
+        }
+        if (top == 0)
+            break;
+        top--;
+        current = stack[top].node;
+        w = stack[top].w;
+    }
+}
+
+bool MotionBVH::hit(const ray &r, float t_min, float t_max,
+                    hit_record &rec) const {
+    if (nodes.empty())
+        return false;
+    bool is_hit = false;
+    traverse(r, t_min, t_max, true, [&](const MotionBVHNode &node) {
+        for (int i = 0; i < node.nPrimitives; i++)
+            if (primitives[node.primitivesOffset + i]->hit(r, t_min, t_max,
+                                                           rec)) {
+                is_hit = true;
+                t_max = rec.t;
+            }
+        return false;
+    });
+    return is_hit;
+}
+
+bool MotionBVH::occluded(const ray &r, float t_min, float t_max) const {
+    if (nodes.empty())
+        return false;
+    bool blocked = false;
+    traverse(r, t_min, t_max, false, [&](const MotionBVHNode &node) {
+        for (int i = 0; i < node.nPrimitives; i++)
+            if (primitives[node.primitivesOffset + i]->occluded(r, t_min,
+                                                                t_max))
+                return blocked = true;
+        return false;
+    });
+    return blocked;
+}
+
+// 收满 k 个交点后用第 k 个的距离剔除
+void MotionBVH::all_hits(const ray &r, float t_min, float t_max,
+                         hit_collector &out) const {
+    if (nodes.empty())
+        return;
+    float bound = out.bound(t_max);
+    traverse(r, t_min, bound, false, [&](const MotionBVHNode &node) {
+        for (int i = 0; i < node.nPrimitives; i++) {
+            primitives[node.primitivesOffset + i]->all_hits(r, t_min, bound,
+                                                            out);
+            bound = out.bound(t_max);
+        }
+        return false;
+    });
+}
+
+// 运动 BVH 的分桶 SAH 构建
+// 空间划分与 SAHBuilder 相同, 只是包围盒换成两端的关键帧包围盒;
+// 运动较大时还尝试把时间区间对半分, 两个孩子各自在半个区间上重新取包围盒,
+// 代价为两半的平均面积乘物体数, 比空间划分更便宜时采用
+// 构建是串行的, 直接按深度优先顺序输出节点
+class MotionBVHBuilder {
+public:
+    static const int MaxBuckets = SAHBuilder::MaxBuckets;
+
+    explicit MotionBVHBuilder(const BVHBuildOptions &opts) : opts(opts) {}
+
+    void build(const vector<shared_ptr<hittable>> &objects, double time0,
+               double time1, MotionBVH &bvh);
+
+private:
+    struct Bucket {
+        int count = 0;
+        MotionBounds bounds;
+    };
+
+    void primitive_bounds(const vector<shared_ptr<hittable>> &objects,
+                          MotionPrimitiveInfo &p, double time0, double time1);
+    void recursive_build(vector<MotionPrimitiveInfo> &info, int start, int end,
+                         double time0, double time1, int time_splits,
+                         int depth);
+
+    BVHBuildOptions opts;
+    const vector<shared_ptr<hittable>> *objects = nullptr;
+    MotionBVH *bvh = nullptr;
+};
+
+void MotionBVHBuilder::primitive_bounds(
+    const vector<shared_ptr<hittable>> &objects, MotionPrimitiveInfo &p,
+    double time0, double time1) {
+    // 时间区间退化为一点时得到该时刻的包围盒
+    if (!objects[p.index]->bounding_box(time0, time0, p.bounds.box[0]) ||
+        !objects[p.index]->bounding_box(time1, time1, p.bounds.box[1]))
+        std::cerr << "No bounding box in MotionBVH builder.\n";
+    p.centroid = 0.25 * (p.bounds.box[0].min() + p.bounds.box[0].max() +
+                         p.bounds.box[1].min() + p.bounds.box[1].max());
+}
+
+void MotionBVHBuilder::build(const vector<shared_ptr<hittable>> &objects,
+                             double time0, double time1, MotionBVH &out) {
+    this->objects = &objects;
+    bvh = &out;
+    bvh->nodes.clear();
+    bvh->primitives.clear();
+    bvh->stats = BVHBuildStats();
+    bvh->timeSplits = 0;
+    bvh->time0 = time0;
+    bvh->inv_duration = time1 > time0 ? 1.0 / (time1 - time0) : 0;
+    int n = objects.size();
+    if (n == 0)
+        return;
+    vector<MotionPrimitiveInfo> info(n);
+#pragma omp parallel for num_threads(build_threads(opts))
+    for (int i = 0; i < n; i++) {
+        info[i].index = i;
+        primitive_bounds(objects, info[i], time0, time1);
+    }
+    bvh->nodes.reserve(2 * n);
+    bvh->primitives.reserve(n);
+    recursive_build(info, 0, n, time0, time1, opts.maxTimeSplits, 0);
+}
+
+void MotionBVHBuilder::recursive_build(vector<MotionPrimitiveInfo> &info,
+                                       int start, int end, double time0,
+                                       double time1, int time_splits,
+                                       int depth) {
+    bvh->stats.maxDepth = max(bvh->stats.maxDepth, depth);
+
+    MotionBounds bounds;
+    AABB centroid_bounds = empty_box();
+    for (int i = start; i < end; i++) {
+        bounds.expand(info[i].bounds);
+        centroid_bounds = surrounding_box(
+            centroid_bounds, AABB(info[i].centroid, info[i].centroid));
+    }
+
+    int index = bvh->nodes.size();
+    bvh->nodes.emplace_back();
+    {
+        MotionBVHNode &node = bvh->nodes[index];
+        // double 转 float 向外取整, 再按两端坐标的量级多放宽,
+        // 抵消遍历时 float 插值的舍入
+        for (int a = 0; a < 3; a++) {
+            float lo[2], hi[2];
+            for (int k = 0; k < 2; k++) {
+                lo[k] = round_down(bounds.box[k].min()[a]);
+                hi[k] = round_up(bounds.box[k].max()[a]);
+            }
+            float lo_pad = 2 * FLT_EPSILON * max(fabsf(lo[0]), fabsf(lo[1]));
+            float hi_pad = 2 * FLT_EPSILON * max(fabsf(hi[0]), fabsf(hi[1]));
+            node.bounds[a] = lo[0] - lo_pad;
+            node.bounds[3 + a] = hi[0] + hi_pad;
+            node.motion[a] = lo[1] - lo[0];
+            node.motion[3 + a] = hi[1] - hi[0];
+        }
+    }
+
+    int n = end - start;
+    int max_leaf = std::clamp(opts.maxLeafSize, 1, 65535);
+    auto make_leaf = [&]() {
+        MotionBVHNode &node = bvh->nodes[index];
+        node.primitivesOffset = bvh->primitives.size();
+        node.nPrimitives = n;
+        node.axis = 0;
+        for (int i = start; i < end; i++)
+            bvh->primitives.push_back((*objects)[info[i].index]);
+    };
+    if (n == 1) {
+        make_leaf();
+        return;
+    }
+
+    double inv_area = 1.0 / max(bounds.area(), DBL_MIN);
+    // 时间划分不减少物体数, 剩余的时间划分次数也计入深度;
+    // 接近遍历栈上限时只按个数对半分
+    bool limited = bvh_depth_limited(depth + time_splits, n);
+
+    // 空间划分: 选中点时刻质心跨度最大的轴分桶
+    vec3 extent = centroid_bounds.max() - centroid_bounds.min();
+    int dim = 0;
+    if (extent[1] > extent[dim])
+        dim = 1;
+    if (extent[2] > extent[dim])
+        dim = 2;
+    int nb = std::clamp(opts.nBuckets, 2, MaxBuckets);
+    double cmin = centroid_bounds.min()[dim];
+    auto bucket_of = [&](const vec3 &c) {
+        int b = nb * ((c[dim] - cmin) / extent[dim]);
+        return b >= nb ? nb - 1 : b;
+    };
+    double min_cost = DBL_MAX;
+    int min_bucket = -1;
+    if (extent[dim] > 0 && !limited) {
+        Bucket buckets[MaxBuckets];
+        for (int i = start; i < end; i++) {
+            Bucket &b = buckets[bucket_of(info[i].centroid)];
+            b.count++;
+            b.bounds.expand(info[i].bounds);
+        }
+        double right_area[MaxBuckets];
+        int right_count[MaxBuckets];
+        MotionBounds acc;
+        int count = 0;
+        for (int i = nb - 1; i > 0; i--) {
+            acc.expand(buckets[i].bounds);
+            count += buckets[i].count;
+            right_area[i] = count ? acc.area() : 0;
+            right_count[i] = count;
+        }
+        acc = MotionBounds();
+        count = 0;
+        for (int i = 0; i < nb - 1; i++) {
+            acc.expand(buckets[i].bounds);
+            count += buckets[i].count;
+            if (count == 0 || right_count[i + 1] == 0)
+                continue;
+            double cost = opts.traversalCost +
+                          opts.intersectCost *
+                              (count * acc.area() +
+                               right_count[i + 1] * right_area[i + 1]) *
+                              inv_area;
+            if (cost < min_cost) {
+                min_cost = cost;
+                min_bucket = i;
+            }
+        }
+    }
+
+    // 时间划分: 在区间中点重新取包围盒
+    // 只在节点的运动范围明显大于它的静态大小时尝试,
+    // 静止或运动很小的节点不付出额外代价
+    double time_mid = 0.5 * (time0 + time1);
+    vector<AABB> mid_boxes;
+    bool time_split = false;
+    double static_area = 0.5 * (bounds.box[0].surface_area() +
+                                bounds.box[1].surface_area());
+    double swept_area =
+        surrounding_box(bounds.box[0], bounds.box[1]).surface_area();
+    if (!limited && time_splits > 0 && time1 > time0 &&
+        swept_area > opts.timeSplitMotion * static_area) {
+        mid_boxes.resize(n);
+        MotionBounds first, second;
+        for (int i = 0; i < n; i++) {
+            (*objects)[info[start + i].index]->bounding_box(time_mid, time_mid,
+                                                           mid_boxes[i]);
+            first.box[1] = surrounding_box(first.box[1], mid_boxes[i]);
+        }
+        first.box[0] = bounds.box[0];
+        second.box[0] = first.box[1];
+        second.box[1] = bounds.box[1];
+        // 每个孩子只被一半时刻的光线访问
+        double cost = opts.traversalCost +
+                      opts.intersectCost * n * 0.5 *
+                          (first.area() + second.area()) * inv_area;
+        if (cost < min_cost) {
+            min_cost = cost;
+            time_split = true;
+        }
+    }
+
+    double leaf_cost = opts.intersectCost * n;
+    if (n <= max_leaf && min_cost >= leaf_cost) {
+        make_leaf();
+        return;
+    }
+
+    if (time_split) {
+        bvh->timeSplits++;
+        // 两半各自复制一份物体信息, 区间端点的包围盒换成中点时刻的
+        // 递归构建会重排 half, 所以每一半都从 info 重新复制
+        vector<MotionPrimitiveInfo> half(n);
+        auto fill_half = [&](int k) {
+            for (int i = 0; i < n; i++) {
+                half[i] = info[start + i];
+                half[i].bounds.box[1 - k] = mid_boxes[i];
+                const MotionBounds &b = half[i].bounds;
+                half[i].centroid = 0.25 * (b.box[0].min() + b.box[0].max() +
+                                           b.box[1].min() + b.box[1].max());
+            }
+        };
+        fill_half(0);
+        recursive_build(half, 0, n, time0, time_mid, time_splits - 1,
+                        depth + 1);
+        fill_half(1);
+        int second = bvh->nodes.size();
+        recursive_build(half, 0, n, time_mid, time1, time_splits - 1,
+                        depth + 1);
+        bvh->nodes[index].secondChildOffset = second;
+        bvh->nodes[index].nPrimitives = 0;
+        bvh->nodes[index].axis = MotionBVHNode::TimeSplit;
+        return;
+    }
+
+    int mid = -1;
+    if (min_bucket >= 0)
+        mid = std::partition(info.begin() + start, info.begin() + end,
+                             [&](const MotionPrimitiveInfo &p) {
+                                 return bucket_of(p.centroid) <= min_bucket;
+                             }) -
+              info.begin();
+    // 质心重合或深度受限时按个数对半分
+    if (mid <= start || mid >= end) {
+        if (n <= max_leaf) {
+            make_leaf();
+            return;
+        }
+        mid = (start + end) / 2;
+        std::nth_element(info.begin() + start, info.begin() + mid,
+                         info.begin() + end,
+                         [dim](const MotionPrimitiveInfo &a,
+                               const MotionPrimitiveInfo &b) {
+                             return a.centroid[dim] < b.centroid[dim];
+                         });
+    }
+
+    recursive_build(info, start, mid, time0, time1, time_splits, depth + 1);
+    int second = bvh->nodes.size();
+    recursive_build(info, mid, end, time0, time1, time_splits, depth + 1);
+    bvh->nodes[index].secondChildOffset = second;
+    bvh->nodes[index].nPrimitives = 0;
+    bvh->nodes[index].axis = dim;
+}
+
+// 构建 [time0, time1] 上的运动 BVH, 并记录构建时间与 SAH 代价
+shared_ptr<MotionBVH>
+build_motion_bvh(hittableList &list, double time0, double time1,
+                 const BVHBuildOptions &opts = BVHBuildOptions()) {
+    double start = omp_get_wtime();
+    auto bvh = make_shared<MotionBVH>();
+    MotionBVHBuilder(opts).build(list.objects, time0, time1, *bvh);
+    bvh->stats.buildTime = omp_get_wtime() - start;
+    bvh->sah_cost(opts.traversalCost, opts.intersectCost);
+    bvh->stats.buildSahCost = bvh->stats.sahCost;
+    return bvh;
+}
+
+#endif // RAYTRACE_MOTIONBVH_HPP
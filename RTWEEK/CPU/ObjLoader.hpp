@@ -0,0 +1,432 @@
+#ifndef RAYTRACE_OBJLOADER_HPP
+#define RAYTRACE_OBJLOADER_HPP
+
+#include "./BVHBuilder.hpp"
+#include "./TriangleMesh.hpp"
+#include "./vec3.hpp"
+#include "omp.h"
+#include <cerrno>
+#include <charconv>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// 索引网格的原始数据, 可直接交给 triangle_mesh
+struct mesh_data {
+    vector<point3> positions;
+    vector<vec3> normals; // 为空或与 positions 一一对应
+    vector<mesh_uv> uvs;  // 为空或与 positions 一一对应
+    vector<uint32_t> indices;
+};
+
+// 只读映射整个文件, 析构时解除映射
+// 打开或映射失败时 valid() 为假, error() 给出原因; 空文件有效, data() 为空
+class mapped_file {
+public:
+    explicit mapped_file(const string &path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            err = errno;
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+            err = errno;
+        else if (st.st_size > 0) {
+            void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED)
+                err = errno;
+            else {
+                ptr = static_cast<const char *>(p);
+                length = st.st_size;
+                // 顺序读取, 让内核提前预读
+                madvise(p, length, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);
+    }
+    ~mapped_file() {
+        if (ptr)
+            munmap(const_cast<char *>(ptr), length);
+    }
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    bool valid() const { return err == 0; }
+    const char *error() const { return strerror(err); }
+    const char *data() const { return ptr; }
+    size_t size() const { return length; }
+    // 改变对访问方式的建议, 构造时为顺序读取
+    void advise(int advice) const {
+        if (ptr)
+            madvise(const_cast<char *>(ptr), length, advice);
+    }
+
+private:
+    int err = 0; // 打开、fstat 或 mmap 失败时的 errno
+    const char *ptr = nullptr;
+    size_t length = 0;
+};
+
+// 并行 OBJ 解析
+// 文件按行边界切成若干块, 每块独立解析出顶点与三角形, 多边形按扇形三角化;
+// 负数 (相对) 索引先记为块内下标, 各块的顶点数做前缀和后再换算成全局下标
+// v/vt/vn 各自独立编号, 只有用到 vt 或 vn 时才把不同的 (v, vt, vn)
+// 组合合并成网格顶点, 只有位置时直接使用 v 的编号
+class ObjParser {
+public:
+    static const size_t ChunkSize = 1 << 20;
+    static const int Missing = INT_MIN;
+
+    bool parse(const char *text, size_t size, mesh_data &out);
+
+    // 第一个出错的行的说明, 解析失败时有效
+    string error;
+
+private:
+    // 三角形的一个角; rel 的第 k 位表示第 k 个分量是块内相对下标
+    struct Corner {
+        int index[3]; // v, vt, vn; 没有的分量为 Missing
+        int rel;
+    };
+    struct Chunk {
+        vector<float> v, vt, vn; // 每个 3, 2, 3 个分量
+        vector<Corner> corners;  // 每 3 个一组
+        string error;
+    };
+
+    void parse_chunk(const char *begin, const char *end, Chunk &chunk) const;
+};
+
+namespace obj_detail {
+inline const char *skip_space(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    return p;
+}
+inline bool read_float(const char *&p, const char *end, float &value) {
+    p = skip_space(p, end);
+    if (p < end && *p == '+')
+        p++;
+    auto result = std::from_chars(p, end, value);
+    if (result.ec != std::errc())
+        return false;
+    p = result.ptr;
+    return true;
+}
+inline bool read_int(const char *&p, const char *end, int &value) {
+    if (p < end && *p == '+')
+        p++;
+    auto result = std::from_chars(p, end, value);
+    if (result.ec != std::errc())
+        return false;
+    p = result.ptr;
+    return true;
+}
+} // namespace obj_detail
+
+void ObjParser::parse_chunk(const char *begin, const char *end,
+                            Chunk &chunk) const {
+    using namespace obj_detail;
+    const char *line = begin;
+    vector<Corner> polygon;
+    while (line < end) {
+        const char *eol =
+            static_cast<const char *>(memchr(line, '\n', end - line));
+        if (!eol)
+            eol = end;
+        const char *p = skip_space(line, eol);
+        const char *next = eol + 1;
+        const char *stop = eol > p && eol[-1] == '\r' ? eol - 1 : eol;
+        auto fail = [&](const char *what) {
+            if (chunk.error.empty())
+                chunk.error = string(what) + ": " + string(line, stop);
+        };
+
+        if (p + 1 < stop && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+            float x, y, z;
+            p += 1;
+            if (read_float(p, stop, x) && read_float(p, stop, y) &&
+                read_float(p, stop, z))
+                chunk.v.insert(chunk.v.end(), {x, y, z});
+            else
+                fail("bad vertex");
+        } else if (p + 2 < stop && p[0] == 'v' && p[1] == 't' &&
+                   (p[2] == ' ' || p[2] == '\t')) {
+            float u, v = 0;
+            p += 2;
+            if (read_float(p, stop, u)) {
+                read_float(p, stop, v); // 一维纹理坐标只有 u
+                chunk.vt.insert(chunk.vt.end(), {u, v});
+            } else
+                fail("bad texture coordinate");
+        } else if (p + 2 < stop && p[0] == 'v' && p[1] == 'n' &&
+                   (p[2] == ' ' || p[2] == '\t')) {
+            float x, y, z;
+            p += 2;
+            if (read_float(p, stop, x) && read_float(p, stop, y) &&
+                read_float(p, stop, z))
+                chunk.vn.insert(chunk.vn.end(), {x, y, z});
+            else
+                fail("bad normal");
+        } else if (p + 1 < stop && p[0] == 'f' &&
+                   (p[1] == ' ' || p[1] == '\t')) {
+            // 角的格式: v, v/vt, v//vn, v/vt/vn
+            polygon.clear();
+            p += 1;
+            bool ok = true;
+            while (true) {
+                p = skip_space(p, stop);
+                if (p >= stop)
+                    break;
+                Corner c = {{Missing, Missing, Missing}, 0};
+                // 负数索引相对于本行之前已定义的个数, 此时块内计数即为基准
+                int counts[3] = {int(chunk.v.size() / 3),
+                                 int(chunk.vt.size() / 2),
+                                 int(chunk.vn.size() / 3)};
+                for (int k = 0; k < 3; k++) {
+                    if (k > 0) {
+                        if (p >= stop || *p != '/')
+                            break;
+                        p++;
+                        if (p < stop && *p == '/')
+                            continue; // v//vn 中的空 vt
+                    }
+                    int value;
+                    if (!read_int(p, stop, value) || value == 0) {
+                        ok = false;
+                        break;
+                    }
+                    if (value > 0)
+                        c.index[k] = value - 1;
+                    else {
+                        c.index[k] = counts[k] + value;
+                        c.rel |= 1 << k;
+                    }
+                }
+                if (!ok || (p < stop && *p != ' ' && *p != '\t')) {
+                    ok = false;
+                    break;
+                }
+                polygon.push_back(c);
+            }
+            if (!ok || polygon.size() < 3)
+                fail("bad face");
+            else
+                for (size_t i = 1; i + 1 < polygon.size(); i++)
+                    chunk.corners.insert(
+                        chunk.corners.end(),
+                        {polygon[0], polygon[i], polygon[i + 1]});
+        }
+        // 注释、分组、材质等其余行忽略
+        line = next;
+    }
+}
+
+bool ObjParser::parse(const char *text, size_t size, mesh_data &out) {
+    out = mesh_data();
+    error.clear();
+    if (size == 0)
+        return true;
+
+    // 块的起点都移到下一行行首, 每行只属于一个块
+    int n_chunks = max<size_t>(1, size / ChunkSize);
+    vector<size_t> bounds(n_chunks + 1);
+    bounds[0] = 0;
+    bounds[n_chunks] = size;
+    for (int k = 1; k < n_chunks; k++) {
+        size_t s = size * k / n_chunks;
+        const char *nl =
+            static_cast<const char *>(memchr(text + s, '\n', size - s));
+        bounds[k] = nl ? nl - text + 1 : size;
+    }
+    vector<Chunk> chunks(n_chunks);
+#pragma omp parallel for schedule(dynamic)
+    for (int k = 0; k < n_chunks; k++)
+        if (bounds[k] < bounds[k + 1])
+            parse_chunk(text + bounds[k], text + bounds[k + 1], chunks[k]);
+    for (const auto &chunk : chunks)
+        if (!chunk.error.empty()) {
+            error = chunk.error;
+            return false;
+        }
+
+    // 各块顶点与三角形的前缀和
+    vector<size_t> v_base(n_chunks + 1, 0), vt_base(n_chunks + 1, 0),
+        vn_base(n_chunks + 1, 0), c_base(n_chunks + 1, 0);
+    for (int k = 0; k < n_chunks; k++) {
+        v_base[k + 1] = v_base[k] + chunks[k].v.size() / 3;
+        vt_base[k + 1] = vt_base[k] + chunks[k].vt.size() / 2;
+        vn_base[k + 1] = vn_base[k] + chunks[k].vn.size() / 3;
+        c_base[k + 1] = c_base[k] + chunks[k].corners.size();
+    }
+    size_t n_v = v_base[n_chunks], n_vt = vt_base[n_chunks],
+           n_vn = vn_base[n_chunks], n_corners = c_base[n_chunks];
+    if (n_v > UINT32_MAX || n_corners / 3 > UINT32_MAX / 3) {
+        error = "mesh too large for 32-bit indices";
+        return false;
+    }
+
+    vector<point3> v(n_v);
+    vector<vec3> vn(n_vn);
+    vector<mesh_uv> vt(n_vt);
+    vector<Corner> corners(n_corners);
+    bool use_attributes = false, bad_index = false;
+#pragma omp parallel for reduction(|| : use_attributes, bad_index)
+    for (int k = 0; k < n_chunks; k++) {
+        const Chunk &c = chunks[k];
+        for (size_t i = 0; i < c.v.size() / 3; i++)
+            v[v_base[k] + i] =
+                point3(c.v[3 * i], c.v[3 * i + 1], c.v[3 * i + 2]);
+        for (size_t i = 0; i < c.vt.size() / 2; i++)
+            vt[vt_base[k] + i] = {c.vt[2 * i], c.vt[2 * i + 1]};
+        for (size_t i = 0; i < c.vn.size() / 3; i++)
+            vn[vn_base[k] + i] =
+                vec3(c.vn[3 * i], c.vn[3 * i + 1], c.vn[3 * i + 2]);
+        size_t base[3] = {v_base[k], vt_base[k], vn_base[k]};
+        size_t limit[3] = {n_v, n_vt, n_vn};
+        for (size_t i = 0; i < c.corners.size(); i++) {
+            Corner r = c.corners[i];
+            for (int a = 0; a < 3; a++) {
+                if (r.index[a] == Missing)
+                    continue;
+                long long g = r.index[a] + (r.rel >> a & 1 ? base[a] : 0);
+                if (g < 0 || g >= (long long)limit[a]) {
+                    bad_index = true;
+                    g = 0;
+                }
+                r.index[a] = g;
+                use_attributes = use_attributes || a > 0;
+            }
+            corners[c_base[k] + i] = r;
+        }
+    }
+    chunks.clear();
+    if (bad_index) {
+        error = "face index out of range";
+        return false;
+    }
+
+    out.indices.resize(n_corners);
+    if (!use_attributes) {
+        // 只有位置: 网格顶点即 v
+        out.positions = std::move(v);
+#pragma omp parallel for
+        for (size_t i = 0; i < n_corners; i++)
+            out.indices[i] = corners[i].index[0];
+        return true;
+    }
+
+    // 合并相同的 (v, vt, vn) 组合; 只要有一个角缺少某个属性就整体不输出该属性
+    bool has_vt = n_vt > 0, has_vn = n_vn > 0;
+    for (const auto &c : corners) {
+        has_vt = has_vt && c.index[1] != Missing;
+        has_vn = has_vn && c.index[2] != Missing;
+    }
+
+    // 常见情形: 每个 v 总是配同一个 vt 与 vn, 直接用 v 的编号, 不必查表
+    vector<int> v_to_vt(n_v, -1), v_to_vn(n_v, -1);
+    bool consistent = true;
+    for (size_t i = 0; i < n_corners && consistent; i++) {
+        const Corner &c = corners[i];
+        int &t = v_to_vt[c.index[0]], &n = v_to_vn[c.index[0]];
+        if (has_vt) {
+            consistent = t < 0 || t == c.index[1];
+            t = c.index[1];
+        }
+        if (has_vn) {
+            consistent = consistent && (n < 0 || n == c.index[2]);
+            n = c.index[2];
+        }
+    }
+    if (consistent) {
+        if (has_vt)
+            out.uvs.resize(n_v, {0, 0});
+        if (has_vn)
+            out.normals.resize(n_v, vec3(0, 0, 0));
+#pragma omp parallel for
+        for (size_t i = 0; i < n_v; i++) {
+            if (has_vt && v_to_vt[i] >= 0)
+                out.uvs[i] = vt[v_to_vt[i]];
+            if (has_vn && v_to_vn[i] >= 0)
+                out.normals[i] = vn[v_to_vn[i]];
+        }
+#pragma omp parallel for
+        for (size_t i = 0; i < n_corners; i++)
+            out.indices[i] = corners[i].index[0];
+        out.positions = std::move(v);
+        return true;
+    }
+
+    // 否则用哈希表合并
+    struct Key {
+        int v, vt, vn;
+        bool operator==(const Key &o) const {
+            return v == o.v && vt == o.vt && vn == o.vn;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key &k) const {
+            return (uint64_t)k.v * 0x9E3779B97F4A7C15ULL ^
+                   (uint64_t)k.vt * 0xC2B2AE3D27D4EB4FULL ^
+                   (uint64_t)k.vn * 0x165667B19E3779F9ULL;
+        }
+    };
+    unordered_map<Key, uint32_t, KeyHash> seen;
+    seen.reserve(n_v * 2);
+    for (size_t i = 0; i < n_corners; i++) {
+        const Corner &c = corners[i];
+        Key k = {c.index[0], has_vt ? c.index[1] : 0,
+                 has_vn ? c.index[2] : 0};
+        auto inserted = seen.emplace(k, (uint32_t)out.positions.size());
+        if (inserted.second) {
+            out.positions.push_back(v[k.v]);
+            if (has_vt)
+                out.uvs.push_back(vt[k.vt]);
+            if (has_vn)
+                out.normals.push_back(vn[k.vn]);
+        }
+        out.indices[i] = inserted.first->second;
+    }
+    return true;
+}
+
+// 读取 OBJ 的顶点与面
+bool read_obj(const string &path, mesh_data &out) {
+    mapped_file file(path);
+    if (!file.valid()) {
+        std::cerr << "Cannot read OBJ file " << path << ": " << file.error()
+                  << ".\n";
+        return false;
+    }
+    ObjParser parser;
+    if (!parser.parse(file.data(), file.size(), out)) {
+        std::cerr << "Failed to parse OBJ file " << path << ": "
+                  << parser.error << "\n";
+        return false;
+    }
+    return true;
+}
+
+// 读取 OBJ 并建成带 BVH 的索引网格, 失败时返回空指针
+shared_ptr<triangle_mesh>
+load_obj(const string &path, shared_ptr<material> m,
+         const BVHBuildOptions &opts = BVHBuildOptions()) {
+    mesh_data data;
+    if (!read_obj(path, data))
+        return nullptr;
+    return make_shared<triangle_mesh>(
+        std::move(data.positions), std::move(data.indices), m,
+        std::move(data.normals), std::move(data.uvs), opts);
+}
+
+#endif // RAYTRACE_OBJLOADER_HPP
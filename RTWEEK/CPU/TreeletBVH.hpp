@@ -0,0 +1,287 @@
+#ifndef RAYTRACE_TREELETBVH_HPP
+#define RAYTRACE_TREELETBVH_HPP
+
+#include "./AABB.hpp"
+#include "./BVHBuilder.hpp"
+#include "./LinearBVH.hpp"
+#include "./hittable.hpp"
+#include "./ray.hpp"
+#include "./vec3.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <queue>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// 与 LinearBVHNode 相同的 32 字节节点, 但孩子位置显式给出:
+// 两个孩子总是相邻并占满同一条缓存行
+struct alignas(32) TreeletBVHNode {
+    float bounds[2][3];
+    union {
+        int primitivesOffset; // 叶子: 第一个物体在 primitives 中的下标
+        int firstChild;       // 内部节点: 第一个孩子的下标, 第二个紧随其后
+    };
+    uint16_t nPrimitives; // 0 表示内部节点
+    uint8_t axis;
+    uint8_t pad;
+
+    inline bool hit(const traversal_ray &r, float tmin, float tmax) const {
+        return slab_hit(&bounds[0][0], r, tmin, tmax);
+    }
+};
+
+// 一对兄弟节点, 按缓存行对齐
+struct alignas(64) TreeletBVHPair {
+    TreeletBVHNode node[2];
+};
+static_assert(sizeof(TreeletBVHPair) == 64, "TreeletBVHPair must be 64 bytes");
+
+// 按 Align 字节对齐分配的 vector 分配器; vector 默认只保证按元素类型对齐,
+// treelet 的页对齐需要数组本身从页边界开始
+template <typename T, size_t Align> struct aligned_allocator {
+    typedef T value_type;
+    template <typename U> struct rebind {
+        typedef aligned_allocator<U, Align> other;
+    };
+
+    aligned_allocator() = default;
+    template <typename U>
+    aligned_allocator(const aligned_allocator<U, Align> &) {}
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(
+            ::operator new(n * sizeof(T), std::align_val_t(Align)));
+    }
+    void deallocate(T *p, size_t) {
+        ::operator delete(p, std::align_val_t(Align));
+    }
+    bool operator==(const aligned_allocator &) const { return true; }
+    bool operator!=(const aligned_allocator &) const { return false; }
+};
+
+// 按 treelet 重排的 BVH 布局
+// 深度优先布局中第二个孩子离父节点很远, 上层的热节点散落在不同的缓存行和页上
+// 这里每对兄弟占一条缓存行; 从根开始按访问概率 (父节点表面积) 贪心地把
+// 兄弟对收进 treelet, 每个 treelet 至多一页; treelet 也按根的访问概率排列,
+// 所以最常访问的上层节点集中在数组开头的几页里
+// 由任意构建方式得到的 LinearBVH 转换而来, 物体顺序不变
+class TreeletBVH : public hittable {
+public:
+    static const int MaxDepth = LinearBVH::MaxDepth;
+    static const int PageBytes = 4096;
+    static const int PairsPerPage = PageBytes / sizeof(TreeletBVHPair);
+
+    TreeletBVH() = default;
+    explicit TreeletBVH(const LinearBVH &bvh);
+
+    virtual bool hit(const ray &r, float t_min, float t_max,
+                     hit_record &rec) const override;
+    virtual bool occluded(const ray &r, float t_min,
+                          float t_max) const override;
+    virtual void all_hits(const ray &r, float t_min, float t_max,
+                          hit_collector &out) const override;
+    virtual bool bounding_box(float t0, float t1,
+                              AABB &output_box) const override;
+
+    // 节点数组占用的字节数, 包括对齐留下的空位
+    size_t node_bytes() const { return pairs.size() * sizeof(TreeletBVHPair); }
+
+    // 根节点在第 0 对的第 0 个位置, 数组从页边界开始
+    vector<TreeletBVHPair, aligned_allocator<TreeletBVHPair, PageBytes>> pairs;
+    vector<shared_ptr<hittable>> primitives;
+    int treelets = 0;
+
+private:
+    const TreeletBVHNode &node(int index) const {
+        return pairs[index >> 1].node[index & 1];
+    }
+};
+
+TreeletBVH::TreeletBVH(const LinearBVH &bvh) {
+    primitives = bvh.primitives;
+    if (bvh.nodes.empty())
+        return;
+    const auto &src = bvh.nodes;
+    auto copy = [](const LinearBVHNode &n) {
+        TreeletBVHNode t;
+        for (int a = 0; a < 3; a++) {
+            t.bounds[0][a] = n.bounds[0][a];
+            t.bounds[1][a] = n.bounds[1][a];
+        }
+        t.primitivesOffset = n.primitivesOffset;
+        t.nPrimitives = n.nPrimitives;
+        t.axis = n.axis;
+        t.pad = 0;
+        return t;
+    };
+
+    // 第一遍: 确定每个内部节点的孩子对放在哪个位置
+    // 堆中为 (父节点表面积, 源节点下标), 表面积正比于父节点被访问的概率
+    vector<int> pair_of(src.size(), -1);
+    typedef pair<double, int> Entry;
+    priority_queue<Entry> roots;
+    int n_pairs = 1; // 第 0 对存放根节点
+    if (src[0].nPrimitives == 0)
+        roots.push({node_area(src[0]), 0});
+    while (!roots.empty()) {
+        priority_queue<Entry> local;
+        local.push(roots.top());
+        roots.pop();
+        vector<int> members;
+        while (!local.empty() && (int)members.size() < PairsPerPage) {
+            int n = local.top().second;
+            local.pop();
+            members.push_back(n);
+            int children[2] = {n + 1, src[n].secondChildOffset};
+            for (int c : children)
+                if (src[c].nPrimitives == 0)
+                    local.push({node_area(src[c]), c});
+        }
+        // 完整的 treelet 从页边界开始, 不会横跨两页; 更小的 treelet 紧凑排列
+        if ((int)members.size() == PairsPerPage && n_pairs % PairsPerPage)
+            n_pairs += PairsPerPage - n_pairs % PairsPerPage;
+        for (int n : members)
+            pair_of[n] = n_pairs++;
+        while (!local.empty()) {
+            roots.push(local.top());
+            local.pop();
+        }
+        treelets++;
+    }
+
+    // 第二遍: 写出节点, 内部节点指向孩子对的第一个位置
+    // 对齐留下的空位与根节点的兄弟位置不会被访问, 保持清零
+    pairs.resize(n_pairs);
+    auto place = [&](int s, TreeletBVHNode &out) {
+        out = copy(src[s]);
+        if (src[s].nPrimitives == 0)
+            out.firstChild = 2 * pair_of[s];
+    };
+    place(0, pairs[0].node[0]);
+    for (int s = 0; s < (int)src.size(); s++) {
+        if (pair_of[s] < 0)
+            continue;
+        place(s + 1, pairs[pair_of[s]].node[0]);
+        place(src[s].secondChildOffset, pairs[pair_of[s]].node[1]);
+    }
+}
+
+bool TreeletBVH::bounding_box(float t0, float t1, AABB &output_box) const {
+    if (pairs.empty())
+        return false;
+    const TreeletBVHNode &root = node(0);
+    output_box = AABB(vec3(root.bounds[0][0], root.bounds[0][1],
+                           root.bounds[0][2]),
+                      vec3(root.bounds[1][0], root.bounds[1][1],
+                           root.bounds[1][2]));
+    return true;
+}
+
+bool TreeletBVH::hit(const ray &r, float t_min, float t_max,
+                     hit_record &rec) const {
+    if (pairs.empty())
+        return false;
+
+    traversal_ray tr(r);
+    bool is_hit = false;
+    int stack[MaxDepth];
+    int top = 0, current = 0;
+    while (true) {
+        const TreeletBVHNode &n = node(current);
+        BVH_COUNT(nodeVisits, 1);
+        BVH_TOUCH(&n);
+        if (n.hit(tr, t_min, t_max)) {
+            if (n.nPrimitives > 0) {
+                BVH_COUNT(primitiveTests, n.nPrimitives);
+                for (int i = 0; i < n.nPrimitives; i++)
+                    if (primitives[n.primitivesOffset + i]->hit(r, t_min,
+                                                                t_max, rec)) {
+                        is_hit = true;
+                        t_max = rec.t;
+                    }
+            } else {
+                // 光线沿负方向时先访问第二个孩子
+                int neg = tr.neg[n.axis];
+                stack[top++] = n.firstChild + 1 - neg;
+                current = n.firstChild + neg;
+                continue;
+            }
+        }
+        if (top == 0)
+            break;
+        current = stack[--top];
+    }
+    return is_hit;
+}
+
+bool TreeletBVH::occluded(const ray &r, float t_min, float t_max) const {
+    if (pairs.empty())
+        return false;
+
+    traversal_ray tr(r);
+    int stack[MaxDepth];
+    int top = 0, current = 0;
+    while (true) {
+        const TreeletBVHNode &n = node(current);
+        BVH_COUNT(nodeVisits, 1);
+        BVH_TOUCH(&n);
+        if (n.hit(tr, t_min, t_max)) {
+            if (n.nPrimitives > 0) {
+                BVH_COUNT(primitiveTests, n.nPrimitives);
+                for (int i = 0; i < n.nPrimitives; i++)
+                    if (primitives[n.primitivesOffset + i]->occluded(
+                            r, t_min, t_max))
+                        return true;
+            } else {
+                stack[top++] = n.firstChild + 1;
+                current = n.firstChild;
+                continue;
+            }
+        }
+        if (top == 0)
+            break;
+        current = stack[--top];
+    }
+    return false;
+}
+
+void TreeletBVH::all_hits(const ray &r, float t_min, float t_max,
+                          hit_collector &out) const {
+    if (pairs.empty())
+        return;
+
+    traversal_ray tr(r);
+    int stack[MaxDepth];
+    int top = 0, current = 0;
+    while (true) {
+        const TreeletBVHNode &n = node(current);
+        BVH_COUNT(nodeVisits, 1);
+        BVH_TOUCH(&n);
+        if (n.hit(tr, t_min, out.bound(t_max))) {
+            if (n.nPrimitives > 0) {
+                BVH_COUNT(primitiveTests, n.nPrimitives);
+                for (int i = 0; i < n.nPrimitives; i++)
+                    primitives[n.primitivesOffset + i]->all_hits(
+                        r, t_min, out.bound(t_max), out);
+            } else {
+                stack[top++] = n.firstChild + 1;
+                current = n.firstChild;
+                continue;
+            }
+        }
+        if (top == 0)
+            break;
+        current = stack[--top];
+    }
+}
+
+// 按选项构建线性 BVH, 再重排为 treelet 布局
+shared_ptr<TreeletBVH>
+build_treelet_bvh(hittableList &list, double time0, double time1,
+                  const BVHBuildOptions &opts = BVHBuildOptions()) {
+    return make_shared<TreeletBVH>(*build_bvh(list, time0, time1, opts));
+}
+
+#endif // RAYTRACE_TREELETBVH_HPP
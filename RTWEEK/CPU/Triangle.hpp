@@ -19,6 +19,9 @@ public:
     virtual bool hit(const ray &r, float t_min, float t_max,
                      hit_record &rec) const override;
     virtual bool bounding_box(float t0, float t1, AABB &box) const override;
+    // 把三角形裁剪到 clip 内, 取裁剪后多边形的包围盒
+    virtual bool clipped_bounding_box(const AABB &clip, float t0, float t1,
+                                      AABB &box) const override;
 };
 
 bool Triangle::hit(const ray &r, float t_min, float t_max,
@@ -37,8 +40,8 @@ bool Triangle::hit(const ray &r, float t_min, float t_max,
 
     // 距离
     float t = (dot(N, p1) - dot(S, N)) / dot(d, N);
-    if (t < 0.0005f)
-        return false; // 如果三角形在相机背面,防止击中自己
+    if (t < t_min || t > t_max)
+        return false; // 不在查询区间内, 放进 BVH 后必须遵守 t_max
 
     // 交点计算
     vec3 P = S + d * t;
@@ -54,12 +57,79 @@ bool Triangle::hit(const ray &r, float t_min, float t_max,
     rec.t = t;
     rec.p = P;
     rec.mat_ptr = this->mat_ptr;
-    rec.normal = N; // 要返回正确的法向
+    rec.set_face_normal(r, unit_vector(n)); // 要返回正确的法向
     return true;
 }
 
+// 与轴对齐的三角形包围盒厚度为 0, 和 Rect 一样两侧各放宽 0.0001
+inline AABB triangle_bounds(const vec3 &p1, const vec3 &p2, const vec3 &p3) {
+    vec3 lo, hi;
+    for (int a = 0; a < 3; a++) {
+        lo[a] = fmin(p1[a], fmin(p2[a], p3[a]));
+        hi[a] = fmax(p1[a], fmax(p2[a], p3[a]));
+        if (hi[a] - lo[a] < 0.0002) {
+            lo[a] -= 0.0001;
+            hi[a] += 0.0001;
+        }
+    }
+    return AABB(lo, hi);
+}
+
+// Sutherland-Hodgman: 依次用 clip 的 6 个平面裁剪多边形,
+// 三角形被一个盒子裁剪后至多 9 个顶点
+inline AABB clipped_triangle_bounds(const vec3 &p1, const vec3 &p2,
+                                    const vec3 &p3, const AABB &clip) {
+    vec3 poly[9] = {p1, p2, p3}, next[9];
+    int n = 3;
+    for (int plane = 0; plane < 6 && n > 0; plane++) {
+        int a = plane % 3;
+        bool upper = plane >= 3;
+        double k = upper ? clip.max()[a] : clip.min()[a];
+        auto inside = [&](const vec3 &p) {
+            return upper ? p[a] <= k : p[a] >= k;
+        };
+        int m = 0;
+        for (int i = 0; i < n; i++) {
+            const vec3 &u = poly[i], &v = poly[(i + 1) % n];
+            if (inside(u))
+                next[m++] = u;
+            if (inside(u) != inside(v)) {
+                vec3 p = u + (v - u) * ((k - u[a]) / (v[a] - u[a]));
+                p[a] = k; // 交点恰好落在平面上
+                next[m++] = p;
+            }
+        }
+        n = m;
+        for (int i = 0; i < n; i++)
+            poly[i] = next[i];
+    }
+    // 与 clip 不相交, 返回空盒
+    if (n == 0)
+        return AABB(clip.max(), clip.min());
+    vec3 lo = poly[0], hi = poly[0];
+    for (int i = 1; i < n; i++)
+        for (int a = 0; a < 3; a++) {
+            lo[a] = fmin(lo[a], poly[i][a]);
+            hi[a] = fmax(hi[a], poly[i][a]);
+        }
+    // 与 triangle_bounds 同样放宽厚度为 0 的轴, 且不超出未裁剪时的包围盒
+    for (int a = 0; a < 3; a++)
+        if (hi[a] - lo[a] < 0.0002) {
+            lo[a] -= 0.0001;
+            hi[a] += 0.0001;
+        }
+    return overlap_box(triangle_bounds(p1, p2, p3), AABB(lo, hi));
+}
+
 bool Triangle::bounding_box(float t0, float t1, AABB &box) const {
-    return false;
+    box = triangle_bounds(p1, p2, p3);
+    return true;
+}
+
+bool Triangle::clipped_bounding_box(const AABB &clip, float t0, float t1,
+                                    AABB &box) const {
+    box = clipped_triangle_bounds(p1, p2, p3, clip);
+    return true;
 }
 
 bool cmpx(const Triangle &t1, const Triangle &t2) {
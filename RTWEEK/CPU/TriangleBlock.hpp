@@ -0,0 +1,138 @@
+#ifndef RAYTRACE_TRIANGLEBLOCK_HPP
+#define RAYTRACE_TRIANGLEBLOCK_HPP
+
+#include "./ray.hpp"
+#include "./vec3.hpp"
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+using namespace std;
+
+// 求交用的单精度光线, 每条光线只转换一次
+struct block_ray {
+    explicit block_ray(const ray &r) {
+        for (int a = 0; a < 3; a++) {
+            o[a] = r.origin()[a];
+            d[a] = r.direction()[a];
+        }
+    }
+    float o[3], d[3];
+};
+
+// 4 个三角形的 SoA 块, 存第一个顶点与两条边, 求交时不再做顶点相减
+// Möller-Trumbore: 一条光线同时与 4 个三角形求交, 只在最后做一次除法;
+// 不足 4 个时空位的边为 0, 行列式为 0 而被剔除
+struct alignas(16) TriangleBlock {
+    static const int Width = 4;
+    static const uint32_t Empty = UINT32_MAX;
+
+    float v0[3][Width];
+    float e1[3][Width];
+    float e2[3][Width];
+    uint32_t face[Width]; // 所属三角形的下标, 空位为 Empty
+
+    void clear() {
+        for (int a = 0; a < 3; a++)
+            for (int i = 0; i < Width; i++)
+                v0[a][i] = e1[a][i] = e2[a][i] = 0;
+        for (int i = 0; i < Width; i++)
+            face[i] = Empty;
+    }
+    void set(int i, const vec3 &p0, const vec3 &p1, const vec3 &p2,
+             uint32_t f) {
+        for (int a = 0; a < 3; a++) {
+            v0[a][i] = p0[a];
+            e1[a][i] = p1[a] - p0[a];
+            e2[a][i] = p2[a] - p0[a];
+        }
+        face[i] = f;
+    }
+
+    // 返回 [t_min, t_max] 内命中的通道掩码, t/u/v 为各通道的距离与重心坐标
+    int intersect(const block_ray &r, float t_min, float t_max, float t[Width],
+                  float u[Width], float v[Width]) const;
+};
+
+inline int TriangleBlock::intersect(const block_ray &r, float t_min,
+                                    float t_max, float t[Width],
+                                    float u[Width], float v[Width]) const {
+#if defined(__SSE2__)
+    __m128 dx = _mm_set1_ps(r.d[0]), dy = _mm_set1_ps(r.d[1]),
+           dz = _mm_set1_ps(r.d[2]);
+    __m128 e1x = _mm_load_ps(e1[0]), e1y = _mm_load_ps(e1[1]),
+           e1z = _mm_load_ps(e1[2]);
+    __m128 e2x = _mm_load_ps(e2[0]), e2y = _mm_load_ps(e2[1]),
+           e2z = _mm_load_ps(e2[2]);
+    auto sub = [](__m128 a, __m128 b, __m128 c, __m128 d) {
+        return _mm_sub_ps(_mm_mul_ps(a, b), _mm_mul_ps(c, d));
+    };
+    // pv = d x e2, det = e1 . pv
+    __m128 px = sub(dy, e2z, dz, e2y), py = sub(dz, e2x, dx, e2z),
+           pz = sub(dx, e2y, dy, e2x);
+    __m128 det = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)),
+        _mm_mul_ps(e1z, pz));
+    __m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), det);
+    // tv = o - v0, u = tv . pv / det
+    __m128 tx = _mm_sub_ps(_mm_set1_ps(r.o[0]), _mm_load_ps(v0[0]));
+    __m128 ty = _mm_sub_ps(_mm_set1_ps(r.o[1]), _mm_load_ps(v0[1]));
+    __m128 tz = _mm_sub_ps(_mm_set1_ps(r.o[2]), _mm_load_ps(v0[2]));
+    __m128 uu = _mm_mul_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)),
+                   _mm_mul_ps(tz, pz)),
+        inv);
+    // qv = tv x e1, v = d . qv / det, t = e2 . qv / det
+    __m128 qx = sub(ty, e1z, tz, e1y), qy = sub(tz, e1x, tx, e1z),
+           qz = sub(tx, e1y, ty, e1x);
+    __m128 vv = _mm_mul_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)),
+                   _mm_mul_ps(dz, qz)),
+        inv);
+    __m128 tt = _mm_mul_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)),
+                   _mm_mul_ps(e2z, qz)),
+        inv);
+    // NaN 使比较为假, 空位与平行的三角形不会命中
+    __m128 zero = _mm_setzero_ps();
+    __m128 ok = _mm_and_ps(_mm_cmpneq_ps(det, zero), _mm_cmpge_ps(uu, zero));
+    ok = _mm_and_ps(ok, _mm_cmpge_ps(vv, zero));
+    ok = _mm_and_ps(ok, _mm_cmple_ps(_mm_add_ps(uu, vv), _mm_set1_ps(1.0f)));
+    ok = _mm_and_ps(ok, _mm_cmpge_ps(tt, _mm_set1_ps(t_min)));
+    ok = _mm_and_ps(ok, _mm_cmple_ps(tt, _mm_set1_ps(t_max)));
+    int mask = _mm_movemask_ps(ok);
+    if (mask) {
+        _mm_storeu_ps(t, tt);
+        _mm_storeu_ps(u, uu);
+        _mm_storeu_ps(v, vv);
+    }
+    return mask;
+#else
+    int mask = 0;
+    for (int i = 0; i < Width; i++) {
+        float px = r.d[1] * e2[2][i] - r.d[2] * e2[1][i];
+        float py = r.d[2] * e2[0][i] - r.d[0] * e2[2][i];
+        float pz = r.d[0] * e2[1][i] - r.d[1] * e2[0][i];
+        float det = e1[0][i] * px + e1[1][i] * py + e1[2][i] * pz;
+        if (det == 0)
+            continue;
+        float inv = 1.0f / det;
+        float tx = r.o[0] - v0[0][i], ty = r.o[1] - v0[1][i],
+              tz = r.o[2] - v0[2][i];
+        u[i] = (tx * px + ty * py + tz * pz) * inv;
+        float qx = ty * e1[2][i] - tz * e1[1][i];
+        float qy = tz * e1[0][i] - tx * e1[2][i];
+        float qz = tx * e1[1][i] - ty * e1[0][i];
+        v[i] = (r.d[0] * qx + r.d[1] * qy + r.d[2] * qz) * inv;
+        t[i] = (e2[0][i] * qx + e2[1][i] * qy + e2[2][i] * qz) * inv;
+        mask |= (u[i] >= 0 && v[i] >= 0 && u[i] + v[i] <= 1 &&
+                 t[i] >= t_min && t[i] <= t_max)
+                << i;
+    }
+    return mask;
+#endif
+}
+
+#endif // RAYTRACE_TRIANGLEBLOCK_HPP
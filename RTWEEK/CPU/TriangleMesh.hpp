@@ -0,0 +1,460 @@
+#ifndef RAYTRACE_TRIANGLEMESH_HPP
+#define RAYTRACE_TRIANGLEMESH_HPP
+
+#include "./AABB.hpp"
+#include "./BVHBuilder.hpp"
+#include "./LinearBVH.hpp"
+#include "./Triangle.hpp"
+#include "./TriangleBlock.hpp"
+#include "./hittable.hpp"
+#include "./ray.hpp"
+#include "./vec3.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+using namespace std;
+
+// 纹理坐标
+struct mesh_uv {
+    float u, v;
+};
+
+// 网格的数组: 自己持有的 vector, 或指向外部内存 (例如映射的网格缓存) 的
+// 只读视图; 视图的内存由 triangle_mesh 的 backing 保持有效,
+// 需要修改时 mutate() 先复制成自己持有的
+template <typename T> class mesh_array {
+public:
+    mesh_array() = default;
+    mesh_array(vector<T> v) : owned(std::move(v)) {}
+    static mesh_array view(const T *data, size_t size) {
+        mesh_array a;
+        a.view_data = data;
+        a.view_size = size;
+        return a;
+    }
+
+    const T *data() const { return view_data ? view_data : owned.data(); }
+    size_t size() const { return view_data ? view_size : owned.size(); }
+    bool empty() const { return size() == 0; }
+    bool is_view() const { return view_data != nullptr; }
+    const T &operator[](size_t i) const { return data()[i]; }
+    const T *begin() const { return data(); }
+    const T *end() const { return data() + size(); }
+
+    vector<T> &mutate() {
+        if (view_data) {
+            owned.assign(view_data, view_data + view_size);
+            view_data = nullptr;
+            view_size = 0;
+        }
+        return owned;
+    }
+
+private:
+    vector<T> owned;
+    const T *view_data = nullptr;
+    size_t view_size = 0;
+};
+
+// 索引三角形网格
+// 顶点位置、法线、纹理坐标在所有三角形间共享, 每个三角形只存 3 个 32 位索引;
+// 材质按三角形区间指定, 不必每个三角形一个指针
+// 网格自带一棵面上的 BVH, 作为单个物体放进场景或实例的 blas,
+// 叶子中的三角形预先算好边并按 4 个一组打包 (TriangleBlock), 遍历时一条光线
+// 同时与 4 个三角形求交, 不经过每个三角形一次的虚函数调用
+class triangle_mesh : public hittable {
+public:
+    static const int MaxDepth = LinearBVH::MaxDepth;
+
+    // normals 与 uvs 可以为空; 不为空时与 positions 一一对应
+    triangle_mesh(vector<point3> positions, vector<uint32_t> indices,
+                  shared_ptr<material> m, vector<vec3> normals = {},
+                  vector<mesh_uv> uvs = {},
+                  const BVHBuildOptions &opts = BVHBuildOptions());
+    // 直接使用已建好的 BVH (例如从网格缓存读出), 不再构建
+    // 数组可以是视图, backing 持有它们所在的内存; BVH 来自外部时
+    // 先用 bvh_valid() 检查
+    triangle_mesh(mesh_array<point3> positions, mesh_array<uint32_t> indices,
+                  shared_ptr<material> m, mesh_array<vec3> normals,
+                  mesh_array<mesh_uv> uvs, mesh_array<LinearBVHNode> nodes,
+                  mesh_array<TriangleBlock> blocks,
+                  shared_ptr<const void> backing = nullptr);
+
+    // 从 first_face 开始 (直到下一个区间的起点) 的三角形使用材质 m
+    void set_material(uint32_t first_face, shared_ptr<material> m);
+
+    // 按选项重建面上的 BVH, 构造时已建过一次
+    void build(const BVHBuildOptions &opts = BVHBuildOptions());
+    // 检查 BVH 的孩子偏移、块区间、三角形下标与深度, 遍历不会越界时为真
+    bool bvh_valid() const;
+
+    virtual bool hit(const ray &r, float t_min, float t_max,
+                     hit_record &rec) const override;
+    virtual bool occluded(const ray &r, float t_min,
+                          float t_max) const override;
+    virtual void all_hits(const ray &r, float t_min, float t_max,
+                          hit_collector &out) const override;
+    virtual bool bounding_box(float t0, float t1,
+                              AABB &output_box) const override;
+
+    int face_count() const { return indices.size() / 3; }
+    AABB face_bounds(uint32_t f) const {
+        return triangle_bounds(vertex(f, 0), vertex(f, 1), vertex(f, 2));
+    }
+    const point3 &vertex(uint32_t f, int k) const {
+        return positions[indices[3 * f + k]];
+    }
+    shared_ptr<material> material_of(uint32_t f) const;
+
+    // 顶点、索引、材质区间与 BVH 占用的字节数
+    size_t memory_bytes() const;
+
+    const mesh_array<LinearBVHNode> &bvh_nodes() const { return nodes; }
+    const mesh_array<TriangleBlock> &bvh_blocks() const { return blocks; }
+
+    mesh_array<point3> positions;
+    mesh_array<vec3> normals;
+    mesh_array<mesh_uv> uvs;
+    mesh_array<uint32_t> indices; // 每 3 个一组
+    BVHBuildStats stats;
+
+private:
+    void validate(shared_ptr<material> m);
+    template <typename F>
+    void traverse(const ray &r, float t_min, const float &t_max, bool ordered,
+                  F on_leaf) const;
+
+    vector<uint32_t> range_start; // 材质区间的第一个三角形, 升序
+    vector<shared_ptr<material>> range_material;
+    // 叶子的 primitivesOffset 为第一个块的下标, nPrimitives 仍为三角形数
+    mesh_array<LinearBVHNode> nodes;
+    mesh_array<TriangleBlock> blocks;
+    shared_ptr<const void> backing; // 视图所在的内存
+};
+
+// 只在构建时使用的单个三角形, 为 BVH 构建器提供包围盒与裁剪包围盒
+class mesh_face : public hittable {
+public:
+    mesh_face(const triangle_mesh *mesh, uint32_t face)
+        : mesh(mesh), face(face) {}
+
+    virtual bool hit(const ray &r, float t_min, float t_max,
+                     hit_record &rec) const override {
+        return false;
+    }
+    virtual bool bounding_box(float t0, float t1,
+                              AABB &output_box) const override {
+        output_box = mesh->face_bounds(face);
+        return true;
+    }
+    virtual bool clipped_bounding_box(const AABB &clip, float t0, float t1,
+                                      AABB &output_box) const override {
+        output_box = clipped_triangle_bounds(mesh->vertex(face, 0),
+                                             mesh->vertex(face, 1),
+                                             mesh->vertex(face, 2), clip);
+        return true;
+    }
+
+    const triangle_mesh *mesh;
+    uint32_t face;
+};
+
+triangle_mesh::triangle_mesh(vector<point3> positions,
+                             vector<uint32_t> indices, shared_ptr<material> m,
+                             vector<vec3> normals, vector<mesh_uv> uvs,
+                             const BVHBuildOptions &opts)
+    : positions(std::move(positions)), normals(std::move(normals)),
+      uvs(std::move(uvs)), indices(std::move(indices)) {
+    validate(m);
+    build(opts);
+}
+
+triangle_mesh::triangle_mesh(mesh_array<point3> positions,
+                             mesh_array<uint32_t> indices,
+                             shared_ptr<material> m, mesh_array<vec3> normals,
+                             mesh_array<mesh_uv> uvs,
+                             mesh_array<LinearBVHNode> nodes,
+                             mesh_array<TriangleBlock> blocks,
+                             shared_ptr<const void> backing)
+    : positions(std::move(positions)), normals(std::move(normals)),
+      uvs(std::move(uvs)), indices(std::move(indices)),
+      nodes(std::move(nodes)), blocks(std::move(blocks)),
+      backing(std::move(backing)) {
+    validate(m);
+    stats.nodes = this->nodes.size();
+}
+
+// 检查索引与属性数组的长度, 并设置整个网格的默认材质
+// 视图只在需要修正时才复制
+void triangle_mesh::validate(shared_ptr<material> m) {
+    if (indices.size() % 3) {
+        std::cerr << "Mesh index count is not a multiple of 3.\n";
+        indices.mutate().resize(indices.size() / 3 * 3);
+    }
+    for (size_t i = 0; i < indices.size(); i++)
+        if (indices[i] >= positions.size()) {
+            std::cerr << "Mesh index out of range.\n";
+            indices.mutate()[i] = 0;
+        }
+    if (!normals.empty() && normals.size() != positions.size()) {
+        std::cerr << "Mesh normal count does not match positions.\n";
+        normals = mesh_array<vec3>();
+    }
+    if (!uvs.empty() && uvs.size() != positions.size()) {
+        std::cerr << "Mesh uv count does not match positions.\n";
+        uvs = mesh_array<mesh_uv>();
+    }
+    range_start.assign(1, 0);
+    range_material.assign(1, m);
+}
+
+void triangle_mesh::set_material(uint32_t first_face,
+                                 shared_ptr<material> m) {
+    auto it = lower_bound(range_start.begin(), range_start.end(), first_face);
+    int i = it - range_start.begin();
+    if (it != range_start.end() && *it == first_face) {
+        range_material[i] = m;
+        return;
+    }
+    range_start.insert(it, first_face);
+    range_material.insert(range_material.begin() + i, m);
+}
+
+shared_ptr<material> triangle_mesh::material_of(uint32_t f) const {
+    auto it = upper_bound(range_start.begin(), range_start.end(), f);
+    return range_material[it - range_start.begin() - 1];
+}
+
+// 借用通用构建器: 每个三角形临时包成 mesh_face, 建完只留下节点,
+// 再把每个叶子的三角形打包成块
+void triangle_mesh::build(const BVHBuildOptions &opts) {
+    nodes = mesh_array<LinearBVHNode>();
+    blocks = mesh_array<TriangleBlock>();
+    if (indices.empty())
+        return;
+    hittableList proxies;
+    proxies.objects.reserve(face_count());
+    for (uint32_t f = 0; f < (uint32_t)face_count(); f++)
+        proxies.add(make_shared<mesh_face>(this, f));
+    auto bvh = build_bvh(proxies, 0, 1, opts);
+    stats = bvh->stats;
+    const int W = TriangleBlock::Width;
+    vector<TriangleBlock> packed;
+    for (auto &node : bvh->nodes) {
+        if (node.nPrimitives == 0)
+            continue;
+        int first = node.primitivesOffset;
+        node.primitivesOffset = packed.size();
+        for (int i = 0; i < node.nPrimitives; i++) {
+            if (i % W == 0) {
+                packed.emplace_back();
+                packed.back().clear();
+            }
+            uint32_t f =
+                static_cast<mesh_face &>(*bvh->primitives[first + i]).face;
+            packed.back().set(i % W, vertex(f, 0), vertex(f, 1), vertex(f, 2),
+                              f);
+        }
+    }
+    nodes = std::move(bvh->nodes);
+    blocks = std::move(packed);
+}
+
+bool triangle_mesh::bvh_valid() const {
+    size_t n = nodes.size();
+    if (n == 0)
+        return indices.empty();
+    const int W = TriangleBlock::Width;
+    // 孩子的下标都大于父节点, 按下标顺序一遍就能求出每个节点的最大深度
+    vector<int> depth(n, 0);
+    for (size_t i = 0; i < n; i++) {
+        const LinearBVHNode &node = nodes[i];
+        if (depth[i] > MaxDepth - 1)
+            return false;
+        if (node.nPrimitives == 0) {
+            size_t second = node.secondChildOffset;
+            if (node.axis > 2 || i + 1 >= n || node.secondChildOffset < 0 ||
+                second <= i || second >= n)
+                return false;
+            depth[i + 1] = max(depth[i + 1], depth[i] + 1);
+            depth[second] = max(depth[second], depth[i] + 1);
+            continue;
+        }
+        size_t n_blocks = (node.nPrimitives + W - 1) / W;
+        if (node.primitivesOffset < 0 ||
+            (size_t)node.primitivesOffset + n_blocks > blocks.size())
+            return false;
+    }
+    // 空位的边为 0, 行列式为 0, 不会被命中
+    for (const TriangleBlock &b : blocks)
+        for (int i = 0; i < W; i++) {
+            if (b.face[i] < (uint32_t)face_count())
+                continue;
+            if (b.face[i] != TriangleBlock::Empty)
+                return false;
+            for (int a = 0; a < 3; a++)
+                if (b.e1[a][i] != 0 || b.e2[a][i] != 0)
+                    return false;
+        }
+    return true;
+}
+
+size_t triangle_mesh::memory_bytes() const {
+    return positions.size() * sizeof(point3) + normals.size() * sizeof(vec3) +
+           uvs.size() * sizeof(mesh_uv) + indices.size() * sizeof(uint32_t) +
+           range_start.size() *
+               (sizeof(uint32_t) + sizeof(shared_ptr<material>)) +
+           nodes.size() * sizeof(LinearBVHNode) +
+           blocks.size() * sizeof(TriangleBlock);
+}
+
+bool triangle_mesh::bounding_box(float t0, float t1, AABB &output_box) const {
+    if (nodes.empty())
+        return false;
+    const LinearBVHNode &root = nodes[0];
+    output_box = AABB(vec3(root.bounds[0][0], root.bounds[0][1],
+                           root.bounds[0][2]),
+                      vec3(root.bounds[1][0], root.bounds[1][1],
+                           root.bounds[1][2]));
+    return true;
+}
+
+// 与 LinearBVH 相同的遍历, 到达叶子时交给 on_leaf; on_leaf 返回 true 时结束
+template <typename F>
+void triangle_mesh::traverse(const ray &r, float t_min, const float &t_max,
+                             bool ordered, F on_leaf) const {
+    traversal_ray tr(r);
+    int stack[MaxDepth];
+    int top = 0, current = 0;
+    while (true) {
+        const LinearBVHNode &node = nodes[current];
+        BVH_COUNT(nodeVisits, 1);
+        BVH_TOUCH(&node);
+        if (node.hit(tr, t_min, t_max)) {
+            if (node.nPrimitives > 0) {
+                BVH_COUNT(primitiveTests, node.nPrimitives);
+                if (on_leaf(node))
+                    return;
+            } else if (ordered && tr.neg[node.axis]) {
+                stack[top++] = current + 1;
+                current = node.secondChildOffset;
+                continue;
+            } else {
+                stack[top++] = node.secondChildOffset;
+                current = current + 1;
+                continue;
+            }
+        }
+        if (top == 0)
+            break;
+        current = stack[--top];
+    }
+}
+
+// 遍历时只记下最近的三角形与重心坐标, 结束后再插值法线和纹理坐标
+bool triangle_mesh::hit(const ray &r, float t_min, float t_max,
+                        hit_record &rec) const {
+    if (nodes.empty())
+        return false;
+    block_ray br(r);
+    int best = -1;
+    float best_b1 = 0, best_b2 = 0;
+    traverse(r, t_min, t_max, true, [&](const LinearBVHNode &node) {
+        const int W = TriangleBlock::Width;
+        int n_blocks = (node.nPrimitives + W - 1) / W;
+        for (int k = 0; k < n_blocks; k++) {
+            const TriangleBlock &b = blocks[node.primitivesOffset + k];
+            float t[W], u[W], v[W];
+            int mask = b.intersect(br, t_min, t_max, t, u, v);
+            while (mask) {
+                int i = __builtin_ctz(mask);
+                mask &= mask - 1;
+                if (t[i] <= t_max) {
+                    best = b.face[i];
+                    t_max = t[i];
+                    best_b1 = u[i];
+                    best_b2 = v[i];
+                }
+            }
+        }
+        return false;
+    });
+    if (best < 0)
+        return false;
+
+    float b0 = 1 - best_b1 - best_b2;
+    rec.t = t_max;
+    rec.p = r.point_at(t_max);
+    vec3 n = cross(vertex(best, 1) - vertex(best, 0),
+                   vertex(best, 2) - vertex(best, 0));
+    rec.set_face_normal(r, unit_vector(n));
+    // 有顶点法线时用插值后的着色法线, 正反面仍按几何法线判断
+    if (!normals.empty()) {
+        const uint32_t *idx = &indices[3 * best];
+        vec3 ns = unit_vector(b0 * normals[idx[0]] + best_b1 * normals[idx[1]] +
+                              best_b2 * normals[idx[2]]);
+        rec.normal = rec.front_face ? ns : -ns;
+    }
+    if (!uvs.empty()) {
+        const uint32_t *idx = &indices[3 * best];
+        rec.u = b0 * uvs[idx[0]].u + best_b1 * uvs[idx[1]].u +
+                best_b2 * uvs[idx[2]].u;
+        rec.v = b0 * uvs[idx[0]].v + best_b1 * uvs[idx[1]].v +
+                best_b2 * uvs[idx[2]].v;
+    } else {
+        rec.u = best_b1;
+        rec.v = best_b2;
+    }
+    rec.mat_ptr = material_of(best);
+    return true;
+}
+
+bool triangle_mesh::occluded(const ray &r, float t_min, float t_max) const {
+    if (nodes.empty())
+        return false;
+    block_ray br(r);
+    bool blocked = false;
+    traverse(r, t_min, t_max, false, [&](const LinearBVHNode &node) {
+        const int W = TriangleBlock::Width;
+        int n_blocks = (node.nPrimitives + W - 1) / W;
+        for (int k = 0; k < n_blocks; k++) {
+            float t[W], u[W], v[W];
+            if (blocks[node.primitivesOffset + k].intersect(br, t_min, t_max,
+                                                            t, u, v))
+                return blocked = true;
+        }
+        return false;
+    });
+    return blocked;
+}
+
+// 交点的物体记为网格本身
+void triangle_mesh::all_hits(const ray &r, float t_min, float t_max,
+                             hit_collector &out) const {
+    if (nodes.empty())
+        return;
+    block_ray br(r);
+    float bound = out.bound(t_max);
+    traverse(r, t_min, bound, false, [&](const LinearBVHNode &node) {
+        const int W = TriangleBlock::Width;
+        int n_blocks = (node.nPrimitives + W - 1) / W;
+        for (int k = 0; k < n_blocks; k++) {
+            const TriangleBlock &b = blocks[node.primitivesOffset + k];
+            float t[W], u[W], v[W];
+            int mask = b.intersect(br, t_min, bound, t, u, v);
+            while (mask) {
+                int i = __builtin_ctz(mask);
+                mask &= mask - 1;
+                uint32_t f = b.face[i];
+                vec3 n = cross(vertex(f, 1) - vertex(f, 0),
+                               vertex(f, 2) - vertex(f, 0));
+                out.add(t[i], this, dot(r.direction(), n) < 0);
+            }
+            bound = out.bound(t_max);
+        }
+        return false;
+    });
+}
+
+#endif // RAYTRACE_TRIANGLEMESH_HPP
@@ -0,0 +1,325 @@
+#ifndef RAYTRACE_WIDEBVH_HPP
+#define RAYTRACE_WIDEBVH_HPP
+
+#include "./AABB.hpp"
+#include "./BVHBuilder.hpp"
+#include "./LinearBVH.hpp"
+#include "./hittable.hpp"
+#include "./ray.hpp"
+#include "./vec3.hpp"
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+using namespace std;
+
+// N 叉 BVH 节点, 孩子包围盒按 SoA 存放, 一次载入同一轴上 N 个孩子的平面
+template <int N> struct alignas(64) WideBVHNode {
+    float bmin[3][N];
+    float bmax[3][N];
+    int32_t child[N];  // 内部孩子: 节点下标; 叶子孩子: 第一个物体的下标
+    uint16_t count[N]; // 0 表示内部孩子, 否则为叶子的物体数
+    int nChildren;
+};
+
+// 由二叉线性 BVH 塌缩得到的 4/8 叉 BVH
+// 每步用 SSE (N = 8 且支持 AVX 时用 AVX) 同时对所有孩子做 slab 测试,
+// 命中的孩子按进入距离排序后入栈, 近的先访问
+template <int N> class WideBVH : public hittable {
+    static_assert(N == 4 || N == 8, "WideBVH supports 4 or 8 children");
+
+public:
+    static const int MaxStack = LinearBVH::MaxDepth * (N - 1) + 1;
+
+    WideBVH() = default;
+    explicit WideBVH(const LinearBVH &bvh);
+
+    virtual bool hit(const ray &r, float t_min, float t_max,
+                     hit_record &rec) const override;
+    virtual bool occluded(const ray &r, float t_min,
+                          float t_max) const override;
+    virtual void all_hits(const ray &r, float t_min, float t_max,
+                          hit_collector &out) const override;
+    virtual bool bounding_box(float t0, float t1,
+                              AABB &output_box) const override;
+
+    vector<WideBVHNode<N>> nodes;
+    vector<shared_ptr<hittable>> primitives;
+
+private:
+    int collapse(const LinearBVH &bvh, int index);
+    int intersect_children(const WideBVHNode<N> &node, const traversal_ray &r,
+                           float t_min, float t_max, float tnear[N]) const;
+
+    AABB box;
+};
+
+template <int N> WideBVH<N>::WideBVH(const LinearBVH &bvh) {
+    primitives = bvh.primitives;
+    if (bvh.nodes.empty())
+        return;
+    bvh.bounding_box(0, 0, box);
+    collapse(bvh, 0);
+}
+
+// 反复展开表面积最大的内部孩子, 直到孩子数达到 N 或全是叶子
+template <int N> int WideBVH<N>::collapse(const LinearBVH &bvh, int index) {
+    int children[N];
+    int n = 0;
+    const LinearBVHNode &root = bvh.nodes[index];
+    if (root.nPrimitives > 0)
+        children[n++] = index;
+    else {
+        children[n++] = index + 1;
+        children[n++] = root.secondChildOffset;
+    }
+    while (n < N) {
+        int best = -1;
+        double best_area = -1;
+        for (int i = 0; i < n; i++) {
+            const LinearBVHNode &c = bvh.nodes[children[i]];
+            if (c.nPrimitives == 0 && node_area(c) > best_area) {
+                best_area = node_area(c);
+                best = i;
+            }
+        }
+        if (best < 0)
+            break;
+        // 展开后保持原有的孩子顺序, 即沿各划分轴从负到正
+        int expand = children[best];
+        for (int i = n; i > best + 1; i--)
+            children[i] = children[i - 1];
+        children[best] = expand + 1;
+        children[best + 1] = bvh.nodes[expand].secondChildOffset;
+        n++;
+    }
+
+    int out = nodes.size();
+    nodes.emplace_back();
+    for (int i = 0; i < N; i++) {
+        for (int a = 0; a < 3; a++) {
+            nodes[out].bmin[a][i] = INFINITY;
+            nodes[out].bmax[a][i] = -INFINITY;
+        }
+        nodes[out].child[i] = 0;
+        nodes[out].count[i] = 0;
+    }
+    nodes[out].nChildren = n;
+    for (int i = 0; i < n; i++) {
+        const LinearBVHNode &c = bvh.nodes[children[i]];
+        for (int a = 0; a < 3; a++) {
+            nodes[out].bmin[a][i] = c.bounds[0][a];
+            nodes[out].bmax[a][i] = c.bounds[1][a];
+        }
+        if (c.nPrimitives > 0) {
+            nodes[out].child[i] = c.primitivesOffset;
+            nodes[out].count[i] = c.nPrimitives;
+        } else {
+            // 递归会使 nodes 重新分配, 不能持有引用
+            int child = collapse(bvh, children[i]);
+            nodes[out].child[i] = child;
+        }
+    }
+    return out;
+}
+
+// 返回命中孩子的位掩码, tnear 为各孩子的进入距离
+// 与 slab_hit 相同: 每个平面一次减法一次乘法, 远端距离放大 SlabRobustScale
+template <int N>
+int WideBVH<N>::intersect_children(const WideBVHNode<N> &node,
+                                   const traversal_ray &r, float t_min,
+                                   float t_max, float tnear[N]) const {
+    int mask = 0;
+#if defined(__AVX__)
+    if constexpr (N == 8) {
+        __m256 tn = _mm256_set1_ps(t_min), tf = _mm256_set1_ps(INFINITY);
+        for (int a = 0; a < 3; a++) {
+            const float *lo = r.neg[a] ? node.bmax[a] : node.bmin[a];
+            const float *hi = r.neg[a] ? node.bmin[a] : node.bmax[a];
+            __m256 ia = _mm256_set1_ps(r.inv[a]);
+            __m256 oa = _mm256_set1_ps(r.org[a]);
+            __m256 t0 =
+                _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(lo), oa), ia);
+            __m256 t1 =
+                _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(hi), oa), ia);
+            tn = _mm256_max_ps(t0, tn);
+            tf = _mm256_min_ps(t1, tf);
+        }
+        tf = _mm256_min_ps(_mm256_mul_ps(tf, _mm256_set1_ps(SlabRobustScale)),
+                           _mm256_set1_ps(t_max));
+        _mm256_storeu_ps(tnear, tn);
+        mask = _mm256_movemask_ps(_mm256_cmp_ps(tn, tf, _CMP_LE_OQ));
+        return mask & ((1 << node.nChildren) - 1);
+    }
+#endif
+#if defined(__SSE2__)
+    for (int k = 0; k < N; k += 4) {
+        __m128 tn = _mm_set1_ps(t_min), tf = _mm_set1_ps(INFINITY);
+        for (int a = 0; a < 3; a++) {
+            const float *lo = r.neg[a] ? node.bmax[a] : node.bmin[a];
+            const float *hi = r.neg[a] ? node.bmin[a] : node.bmax[a];
+            __m128 ia = _mm_set1_ps(r.inv[a]), oa = _mm_set1_ps(r.org[a]);
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(lo + k), oa), ia);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(hi + k), oa), ia);
+            tn = _mm_max_ps(t0, tn);
+            tf = _mm_min_ps(t1, tf);
+        }
+        tf = _mm_min_ps(_mm_mul_ps(tf, _mm_set1_ps(SlabRobustScale)),
+                        _mm_set1_ps(t_max));
+        _mm_storeu_ps(tnear + k, tn);
+        mask |= _mm_movemask_ps(_mm_cmple_ps(tn, tf)) << k;
+    }
+#else
+    for (int i = 0; i < N; i++) {
+        float bounds[6];
+        for (int a = 0; a < 3; a++) {
+            bounds[a] = node.bmin[a][i];
+            bounds[3 + a] = node.bmax[a][i];
+        }
+        mask |= slab_hit(bounds, r, t_min, t_max) << i;
+        // 只用于排序, 近似即可
+        tnear[i] = t_min;
+    }
+#endif
+    return mask & ((1 << node.nChildren) - 1);
+}
+
+template <int N>
+bool WideBVH<N>::bounding_box(float t0, float t1, AABB &output_box) const {
+    if (nodes.empty())
+        return false;
+    output_box = box;
+    return true;
+}
+
+template <int N>
+bool WideBVH<N>::hit(const ray &r, float t_min, float t_max,
+                     hit_record &rec) const {
+    if (nodes.empty())
+        return false;
+
+    traversal_ray tr(r);
+
+    // 栈中同时记录进入距离, 出栈时跳过已比最近交点更远的孩子
+    struct Entry {
+        int child;
+        int count;
+        float t;
+    };
+    Entry stack[MaxStack];
+    int top = 0;
+    stack[top++] = {0, 0, t_min};
+    bool is_hit = false;
+    while (top > 0) {
+        Entry e = stack[--top];
+        if (e.t > t_max)
+            continue;
+        if (e.count > 0) {
+            BVH_COUNT(primitiveTests, e.count);
+            for (int i = 0; i < e.count; i++)
+                if (primitives[e.child + i]->hit(r, t_min, t_max, rec)) {
+                    is_hit = true;
+                    t_max = rec.t;
+                }
+            continue;
+        }
+
+        const WideBVHNode<N> &node = nodes[e.child];
+        BVH_COUNT(nodeVisits, 1);
+        BVH_TOUCH(&node);
+        alignas(32) float tnear[N];
+        int mask = intersect_children(node, tr, t_min, t_max, tnear);
+
+        // 按进入距离从远到近入栈, 插入排序对至多 N 个元素足够快
+        int base = top;
+        while (mask) {
+            int i = __builtin_ctz(mask);
+            mask &= mask - 1;
+            Entry c = {node.child[i], node.count[i], tnear[i]};
+            int j = top++;
+            while (j > base && stack[j - 1].t < c.t) {
+                stack[j] = stack[j - 1];
+                j--;
+            }
+            stack[j] = c;
+        }
+    }
+    return is_hit;
+}
+
+// 任意交点查询不需要排序, 命中的孩子直接入栈
+template <int N>
+bool WideBVH<N>::occluded(const ray &r, float t_min, float t_max) const {
+    if (nodes.empty())
+        return false;
+
+    traversal_ray tr(r);
+    int stack[MaxStack];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const WideBVHNode<N> &node = nodes[stack[--top]];
+        BVH_COUNT(nodeVisits, 1);
+        BVH_TOUCH(&node);
+        alignas(32) float tnear[N];
+        int mask = intersect_children(node, tr, t_min, t_max, tnear);
+        while (mask) {
+            int i = __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (node.count[i] == 0) {
+                stack[top++] = node.child[i];
+                continue;
+            }
+            BVH_COUNT(primitiveTests, node.count[i]);
+            for (int k = 0; k < node.count[i]; k++)
+                if (primitives[node.child[i] + k]->occluded(r, t_min, t_max))
+                    return true;
+        }
+    }
+    return false;
+}
+
+// 多交点查询不排序孩子, 收满 k 个交点后用第 k 个的距离剔除
+template <int N>
+void WideBVH<N>::all_hits(const ray &r, float t_min, float t_max,
+                          hit_collector &out) const {
+    if (nodes.empty())
+        return;
+
+    traversal_ray tr(r);
+    int stack[MaxStack];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const WideBVHNode<N> &node = nodes[stack[--top]];
+        BVH_COUNT(nodeVisits, 1);
+        BVH_TOUCH(&node);
+        alignas(32) float tnear[N];
+        int mask =
+            intersect_children(node, tr, t_min, out.bound(t_max), tnear);
+        while (mask) {
+            int i = __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (node.count[i] == 0) {
+                stack[top++] = node.child[i];
+                continue;
+            }
+            BVH_COUNT(primitiveTests, node.count[i]);
+            for (int k = 0; k < node.count[i]; k++)
+                primitives[node.child[i] + k]->all_hits(
+                    r, t_min, out.bound(t_max), out);
+        }
+    }
+}
+
+// 先按选项构建二叉 BVH, 再塌缩成 N 叉
+template <int N>
+shared_ptr<WideBVH<N>>
+build_wide_bvh(hittableList &list, double time0, double time1,
+               const BVHBuildOptions &opts = BVHBuildOptions()) {
+    return make_shared<WideBVH<N>>(*build_bvh(list, time0, time1, opts));
+}
+
+#endif // RAYTRACE_WIDEBVH_HPP
@@ -0,0 +1,1072 @@
+// BVH 构建与遍历基准
+// 用法: RayTraceBench build [scene] [size]
+//       RayTraceBench threads [scene] [size]  并行构建时间随线程数的变化
+//       RayTraceBench slab                    单个包围盒测试的耗时
+//       RayTraceBench shadow [scene] [size]   最近交点与任意交点查询对比
+//       RayTraceBench refit [size]            动画中 refit 与重建的对比
+//       RayTraceBench motion [size]           运动模糊场景的运动 BVH
+//       RayTraceBench instance [copies]       实例化与展开成单层 BVH 的对比
+//       RayTraceBench layout [size]           深度优先与 treelet 布局的缓存缺失
+//       RayTraceBench compress [size]         量化节点与未压缩节点的内存和吞吐
+//       RayTraceBench lazy [scene] [size]     完整构建与延迟构建的首帧等待时间
+//       RayTraceBench mesh [size]             独立三角形与共享顶点网格的对比
+//       RayTraceBench tri [size]              逐个三角形求交与 4 路三角形块
+//       RayTraceBench obj [size]              OBJ 读取与逐行解析的对比
+//       RayTraceBench cache [size]            读取 OBJ 并构建与读取网格缓存
+//       RayTraceBench box [size]              解析盒子与 Rect 拼成的盒子对比
+//   scene: random (random_scene 网格, size 为半边长)
+//          spheres (size 个随机小球)
+//          boxes (final_scene 地面, size x size 个盒子)
+//          final (final_scene 顶层物体)
+//          triangles (细分球面的 size 个小三角形, 加上地面和细长三角形)
+
+#include "./BVHBuilder.hpp"
+#include "./CompressedBVH.hpp"
+#include "./Instance.hpp"
+#include "./LazyBVH.hpp"
+#include "./MeshCache.hpp"
+#include "./MotionBVH.hpp"
+#include "./ObjLoader.hpp"
+#include "./TreeletBVH.hpp"
+#include "./TriangleBlock.hpp"
+#include "./TriangleMesh.hpp"
+#include "./WideBVH.hpp"
+#include "./camera.hpp"
+#include "./customScene.hpp"
+
+#include "omp.h"
+#include <cfloat>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+hittableList bench_spheres(int n) {
+    hittableList objects;
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    double side = 165.0 * cbrt(n / 1000.0);
+    for (int i = 0; i < n; i++)
+        objects.add(make_shared<sphere>(vec3::random(0, side), 10, white));
+    return objects;
+}
+
+hittableList bench_boxes(int boxes_per_side) {
+    hittableList objects;
+    auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
+    for (int i = 0; i < boxes_per_side; i++)
+        for (int j = 0; j < boxes_per_side; j++) {
+            auto w = 100.0;
+            auto x0 = -1000.0 + i * w;
+            auto z0 = -1000.0 + j * w;
+            objects.add(make_shared<box>(
+                vec3(x0, 0, z0), vec3(x0 + w, random_double(1, 101), z0 + w),
+                ground));
+        }
+    return objects;
+}
+
+// 大小三角形混杂: 两个三角形组成的大地面, 贯穿场景的细长三角形,
+// 以及若干细分球面上的小三角形
+hittableList bench_triangles(int n) {
+    hittableList objects;
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    double side = 165.0 * cbrt(n / 1000.0);
+    objects.add(make_shared<Triangle>(vec3(-side, 0, -side),
+                                      vec3(2 * side, 0, -side),
+                                      vec3(-side, 0, 2 * side), white));
+    objects.add(make_shared<Triangle>(vec3(2 * side, 0, -side),
+                                      vec3(2 * side, 0, 2 * side),
+                                      vec3(-side, 0, 2 * side), white));
+    for (int i = 0; i < 64; i++) {
+        vec3 p = vec3::random(0, side);
+        vec3 q = p + side * random_unit_vector();
+        objects.add(make_shared<Triangle>(p, q, p + vec3::random(-2, 2),
+                                          white));
+    }
+    // 每个球面 stacks x slices 个格子, 每格两个三角形
+    const int stacks = 16, slices = 32;
+    int spheres = max(1, n / (2 * stacks * slices));
+    for (int s = 0; s < spheres; s++) {
+        vec3 c = vec3::random(0, side);
+        double r = random_double(2, 8);
+        auto at = [&](int i, int j) {
+            double theta = M_PI * i / stacks, phi = 2 * M_PI * j / slices;
+            return c + r * vec3(sin(theta) * cos(phi), cos(theta),
+                                sin(theta) * sin(phi));
+        };
+        for (int i = 0; i < stacks; i++)
+            for (int j = 0; j < slices; j++) {
+                objects.add(make_shared<Triangle>(at(i, j), at(i + 1, j),
+                                                  at(i + 1, j + 1), white));
+                objects.add(make_shared<Triangle>(at(i, j), at(i + 1, j + 1),
+                                                  at(i, j + 1), white));
+            }
+    }
+    return objects;
+}
+
+hittableList bench_scene(const string &name, int size) {
+    if (name == "random")
+        return random_scene_objects(size > 0 ? size : 5);
+    if (name == "boxes")
+        return bench_boxes(size > 0 ? size : 20);
+    if (name == "final")
+        return final_scene();
+    if (name == "triangles")
+        return bench_triangles(size > 0 ? size : 100000);
+    return bench_spheres(size > 0 ? size : 100000);
+}
+
+// 场景包围盒内随机起点、随机方向的光线
+vector<ray> bench_rays(const hittable &world, int n) {
+    AABB box;
+    world.bounding_box(0, 1, box);
+    vector<ray> rays(n);
+    for (int i = 0; i < n; i++) {
+        vec3 o(random_double(box.min().x(), box.max().x()),
+               random_double(box.min().y(), box.max().y()),
+               random_double(box.min().z(), box.max().z()));
+        rays[i] = ray(o, random_unit_vector(), random_double());
+    }
+    return rays;
+}
+
+struct TraceResult {
+    double mrays;
+    int hits;
+    double nodes_per_ray, prims_per_ray;
+};
+
+// 单线程求最近交点, 同时统计每条光线访问的节点数与求交的物体数
+TraceResult bench_trace(const hittable &world, const vector<ray> &rays) {
+    TraceResult result = {0, 0, 0, 0};
+    bvh_counters() = BVHCounters();
+    double start = omp_get_wtime();
+    for (const auto &r : rays) {
+        hit_record rec;
+        result.hits += world.hit(r, 0.001, FLT_MAX, rec);
+    }
+    result.mrays = rays.size() / (omp_get_wtime() - start) * 1e-6;
+    result.nodes_per_ray = (double)bvh_counters().nodeVisits / rays.size();
+    result.prims_per_ray =
+        (double)bvh_counters().primitiveTests / rays.size();
+    return result;
+}
+
+// 每条光线 all_hits 收集到的交点数
+vector<int> bench_all_hits(const hittable &world, const vector<ray> &rays,
+                           int k) {
+    vector<int> counts(rays.size());
+    for (size_t i = 0; i < rays.size(); i++) {
+        hit_collector out(k);
+        world.all_hits(rays[i], 0.001, FLT_MAX, out);
+        counts[i] = out.count;
+    }
+    return counts;
+}
+
+void print_header() {
+    printf("%-14s %10s %9s %9s %9s %6s %6s %9s %9s %9s %8s\n", "builder",
+           "build(ms)", "SAH", "nodes", "leaves", "depth", "dup", "Mrays/s",
+           "nodes/ray", "prims/ray", "hits");
+}
+
+void print_stats(const char *name, const BVHBuildStats &stats,
+                 const TraceResult &t) {
+    printf("%-14s %10.2lf %9.3lf %9d %9d %6d %6.3lf %9.3lf %9.2lf %9.2lf "
+           "%8d\n",
+           name, stats.buildTime * 1000, stats.sahCost, stats.nodes,
+           stats.leaves, stats.maxDepth, stats.duplication, t.mrays,
+           t.nodes_per_ray, t.prims_per_ray, t.hits);
+}
+
+// 比较各构建方式的构建时间、SAH 代价与遍历速度
+void bench_build(const string &scene, int size) {
+    auto objects = bench_scene(scene, size);
+    printf("scene %s: %zu primitives\n", scene.c_str(),
+           objects.objects.size());
+
+    struct Config {
+        const char *name;
+        BVHBuildOptions opts;
+    };
+    vector<Config> configs;
+    Config c;
+    c = {"sweep", BVHBuildOptions()};
+    c.opts.method = BVH_SWEEP;
+    configs.push_back(c);
+    c = {"binned-leaf1", BVHBuildOptions()};
+    c.opts.maxLeafSize = 1;
+    configs.push_back(c);
+    c = {"binned-16", BVHBuildOptions()};
+    configs.push_back(c);
+    c = {"binned-32", BVHBuildOptions()};
+    c.opts.nBuckets = 32;
+    configs.push_back(c);
+    c = {"lbvh-30", BVHBuildOptions()};
+    c.opts.method = BVH_LBVH;
+    configs.push_back(c);
+    c = {"lbvh-63", BVHBuildOptions()};
+    c.opts.method = BVH_LBVH;
+    c.opts.mortonBits = 63;
+    configs.push_back(c);
+    c = {"hlbvh", BVHBuildOptions()};
+    c.opts.method = BVH_HLBVH;
+    configs.push_back(c);
+    c = {"sbvh", BVHBuildOptions()};
+    c.opts.method = BVH_SBVH;
+    configs.push_back(c);
+
+    vector<ray> rays;
+    vector<int> sah_counts, sbvh_counts;
+    print_header();
+    for (auto &config : configs) {
+        // BVHNode 会重排物体顺序, 每种构建使用独立副本
+        hittableList list = objects;
+        auto bvh = build_bvh(list, 0, 1, config.opts);
+        if (rays.empty())
+            rays = bench_rays(*bvh, 200000);
+        print_stats(config.name, bvh->stats, bench_trace(*bvh, rays));
+        if (strcmp(config.name, "binned-16") == 0)
+            sah_counts = bench_all_hits(*bvh, rays, 8);
+        if (config.opts.method == BVH_SBVH)
+            sbvh_counts = bench_all_hits(*bvh, rays, 8);
+    }
+
+    // SBVH 的重复引用不应产生重复交点, 多交点数与 SAH 构建一致
+    int mismatched = 0;
+    for (size_t i = 0; i < rays.size(); i++)
+        mismatched += sah_counts[i] != sbvh_counts[i];
+    printf("all_hits sbvh vs binned-16: %d/%zu rays differ\n", mismatched,
+           rays.size());
+
+    // 由 binned-16 塌缩得到的 4/8 叉 BVH, nodes 为宽节点数
+    {
+        hittableList list = objects;
+        auto bvh = build_bvh(list, 0, 1);
+        double start = omp_get_wtime();
+        WideBVH<4> wide4(*bvh);
+        BVHBuildStats stats = bvh->stats;
+        stats.buildTime += omp_get_wtime() - start;
+        stats.nodes = wide4.nodes.size();
+        print_stats("wide4", stats, bench_trace(wide4, rays));
+        start = omp_get_wtime();
+        WideBVH<8> wide8(*bvh);
+        stats = bvh->stats;
+        stats.buildTime += omp_get_wtime() - start;
+        stats.nodes = wide8.nodes.size();
+        print_stats("wide8", stats, bench_trace(wide8, rays));
+    }
+
+    // 原始的指针树 BVHNode, 没有遍历计数
+    hittableList list = objects;
+    BVHBuildStats stats;
+    double start = omp_get_wtime();
+    BVHNode root(list, 0, 1);
+    stats.buildTime = omp_get_wtime() - start;
+    print_stats("BVHNode", stats, bench_trace(root, rays));
+}
+
+// 不同线程数下的构建时间, 并检查得到的树与单线程构建逐节点相同
+void bench_threads(const string &scene, int size) {
+    auto objects = bench_scene(scene, size);
+    printf("scene %s: %zu primitives\n", scene.c_str(),
+           objects.objects.size());
+    printf("%8s %10s %9s %9s\n", "threads", "build(ms)", "speedup",
+           "identical");
+
+    shared_ptr<LinearBVH> reference;
+    int max_threads = omp_get_max_threads();
+    for (int threads = 1;; threads = min(threads * 2, max_threads)) {
+        BVHBuildOptions opts;
+        opts.threads = threads;
+        // 取三次中最快的一次
+        shared_ptr<LinearBVH> bvh;
+        double best = DBL_MAX;
+        for (int i = 0; i < 3; i++) {
+            hittableList list = objects;
+            bvh = build_bvh(list, 0, 1, opts);
+            best = min(best, bvh->stats.buildTime);
+        }
+        if (!reference)
+            reference = bvh;
+        bool identical =
+            bvh->nodes.size() == reference->nodes.size() &&
+            memcmp(bvh->nodes.data(), reference->nodes.data(),
+                   bvh->nodes.size() * sizeof(LinearBVHNode)) == 0 &&
+            bvh->primitives == reference->primitives;
+        printf("%8d %10.2lf %9.2lf %9s\n", threads, best * 1000,
+               reference->stats.buildTime / best, identical ? "yes" : "NO");
+        if (threads == max_threads)
+            break;
+    }
+}
+
+// 每次节点访问的包围盒测试: 原 AABB::hit 与预计算的 traversal_ray 对比
+// 盒子数量小到能放进 L1, 只测计算本身
+void bench_slab() {
+    const int n_boxes = 1024, n_rays = 4096;
+    vector<AABB> boxes(n_boxes);
+    vector<LinearBVHNode> nodes(n_boxes);
+    for (int i = 0; i < n_boxes; i++) {
+        vec3 p = vec3::random(-10, 10), d = vec3::random(0.1, 3);
+        boxes[i] = AABB(p, p + d);
+        nodes[i].set_bounds(boxes[i]);
+    }
+    vector<ray> rays(n_rays);
+    for (auto &r : rays)
+        r = ray(vec3::random(-12, 12), random_unit_vector());
+
+    printf("%-26s %10s %10s\n", "slab test", "ns/test", "hits");
+    auto run = [&](const char *name, auto &&test) {
+        long hits = 0;
+        double start = omp_get_wtime();
+        for (const auto &r : rays)
+            hits += test(r);
+        double ns = (omp_get_wtime() - start) * 1e9 / n_rays / n_boxes;
+        printf("%-26s %10.3lf %10ld\n", name, ns, hits);
+    };
+    run("AABB::hit(ray)", [&](const ray &r) {
+        int hits = 0;
+        for (const auto &box : boxes)
+            hits += box.hit(r, 0.001f, FLT_MAX);
+        return hits;
+    });
+    run("AABB::hit(traversal_ray)", [&](const ray &r) {
+        traversal_ray tr(r);
+        int hits = 0;
+        for (const auto &box : boxes)
+            hits += box.hit(tr, 0.001f, FLT_MAX);
+        return hits;
+    });
+    run("LinearBVHNode::hit", [&](const ray &r) {
+        traversal_ray tr(r);
+        int hits = 0;
+        for (const auto &node : nodes)
+            hits += node.hit(tr, 0.001f, FLT_MAX);
+        return hits;
+    });
+}
+
+// 同一组光线分别做最近交点查询和 occluded 查询
+void bench_shadow(const string &scene, int size) {
+    auto objects = bench_scene(scene, size);
+    printf("scene %s: %zu primitives\n", scene.c_str(),
+           objects.objects.size());
+    hittableList list = objects;
+    auto bvh = build_bvh(list, 0, 1);
+    WideBVH<8> wide8(*bvh);
+    auto rays = bench_rays(*bvh, 200000);
+
+    printf("%-10s %12s %12s %12s %12s\n", "bvh", "hit Mrays/s",
+           "occ Mrays/s", "hit nodes", "occ nodes");
+    auto run = [&](const char *name, const hittable &world) {
+        TraceResult closest = bench_trace(world, rays);
+        bvh_counters() = BVHCounters();
+        int blocked = 0;
+        double start = omp_get_wtime();
+        for (const auto &r : rays)
+            blocked += world.occluded(r, 0.001, FLT_MAX);
+        double mrays = rays.size() / (omp_get_wtime() - start) * 1e-6;
+        double nodes = (double)bvh_counters().nodeVisits / rays.size();
+        printf("%-10s %12.3lf %12.3lf %12.2lf %12.2lf%s\n", name,
+               closest.mrays, mrays, closest.nodes_per_ray, nodes,
+               blocked == closest.hits ? "" : "  MISMATCH");
+    };
+    run("binary", *bvh);
+    run("wide8", wide8);
+}
+
+// 小球每帧随机游走, 比较 update_bvh 的 refit/重建与每帧完整构建
+void bench_refit(int size) {
+    int n = size > 0 ? size : 100000;
+    double side = 165.0 * cbrt(n / 1000.0);
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    hittableList list;
+    vector<shared_ptr<translate>> movers;
+    for (int i = 0; i < n; i++) {
+        movers.push_back(make_shared<translate>(
+            make_shared<sphere>(vec3::random(0, side), 10, white), vec3()));
+        list.add(movers.back());
+    }
+    printf("%d moving spheres\n", n);
+    // drift: refit 后相对上次构建的 SAH 比值; vs fresh: 相对本帧完整构建
+    printf("%6s %10s %10s %9s %9s %8s\n", "frame", "update(ms)",
+           "build(ms)", "drift", "vs fresh", "action");
+
+    BVHBuildOptions opts;
+    auto bvh = build_bvh(list, 0, 1, opts);
+    for (int frame = 1; frame <= 20; frame++) {
+        for (auto &m : movers)
+            m->offset += vec3::random(-4, 4);
+
+        double start = omp_get_wtime();
+        auto updated = update_bvh(bvh, list, 0, 1, opts);
+        double update_ms = (omp_get_wtime() - start) * 1000;
+        // update_bvh 重建时 list 的顺序不变, 这里单独计时一次完整构建作对照
+        hittableList copy = list;
+        auto rebuilt = build_bvh(copy, 0, 1, opts);
+        printf("%6d %10.2lf %10.2lf %9.3lf %9.3lf %8s\n", frame, update_ms,
+               rebuilt->stats.buildTime * 1000,
+               bvh->stats.sahCost / bvh->stats.buildSahCost,
+               bvh->stats.sahCost / rebuilt->stats.sahCost,
+               updated == bvh ? "refit" : "rebuild");
+        bvh = updated;
+    }
+}
+
+// 运动模糊场景: 普通 BVH 用整个快门区间扫过的包围盒,
+// 运动 BVH 按光线时刻插值, 另给出物体静止在快门开启位置时的普通 BVH 作对照
+void bench_motion(int size) {
+    int half = size > 0 ? size : 11;
+    auto random_objects = random_scene_objects(half);
+    // 运动距离远大于半径的小球, 扫过的包围盒严重重叠
+    hittableList fast;
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    for (int i = 0; i < 4 * half * half; i++) {
+        vec3 c = vec3::random(-half, half);
+        fast.add(make_shared<moving_sphere>(
+            c, c + 3.0 * random_unit_vector(), 0, 1, 0.2, white));
+    }
+
+    // 相机光线, 光线时刻在快门区间内均匀分布
+    auto camera_rays = [](const camera &cam, int n) {
+        vector<ray> rays(n);
+        for (auto &r : rays)
+            r = cam.get_ray(random_double(), random_double());
+        return rays;
+    };
+
+    auto run = [&](const char *scene, hittableList &objects,
+                   const camera &cam) {
+        printf("scene %s: %zu primitives\n", scene, objects.objects.size());
+        hittableList still;
+        for (auto &obj : objects.objects) {
+            auto m = dynamic_pointer_cast<moving_sphere>(obj);
+            still.add(m ? make_shared<sphere>(m->center0, m->radius,
+                                              m->mat_ptr)
+                        : obj);
+        }
+        auto swept = build_bvh(objects, 0, 1);
+        auto rays = camera_rays(cam, 200000);
+        print_header();
+        print_stats("swept", swept->stats, bench_trace(*swept, rays));
+        BVHBuildOptions opts;
+        opts.maxTimeSplits = 0;
+        auto motion = build_motion_bvh(objects, 0, 1, opts);
+        print_stats("motion", motion->stats, bench_trace(*motion, rays));
+        opts.maxTimeSplits = BVHBuildOptions().maxTimeSplits;
+        auto split = build_motion_bvh(objects, 0, 1, opts);
+        print_stats("motion+time", split->stats, bench_trace(*split, rays));
+        printf("time splits %d, references %zu\n", split->timeSplits,
+               split->primitives.size());
+        auto fixed = build_bvh(still, 0, 1);
+        print_stats("static", fixed->stats, bench_trace(*fixed, rays));
+    };
+    // 与 random_scene 的相机相同
+    run("random", random_objects,
+        camera(point3(13, 2, 3), point3(0, 0, 0), vec3(0, 1, 0), 20, 1, 0, 10,
+               0, 1));
+    run("fast", fast,
+        camera(point3(0, 0, -4 * half), point3(0, 0, 0), vec3(0, 1, 0), 40, 1,
+               0, 10, 0, 1));
+}
+
+// final_scene 中 boxes2 那样的球团摆放 copies 份
+// 两层: 球团的 BVH 只建一次, 顶层 BVH 只包含实例;
+// 单层: 把每份球团的小球变换到世界空间后建一棵 BVH
+void bench_instance(int copies) {
+    copies = copies > 0 ? copies : 1000;
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    vector<vec3> centers(1000);
+    hittableList cluster;
+    for (auto &c : centers) {
+        c = vec3::random(0, 165);
+        cluster.add(make_shared<sphere>(c, 10, white));
+    }
+    double side = 400.0 * cbrt(copies);
+    vector<affine3> placements(copies);
+    for (auto &p : placements)
+        p = affine3::translation(vec3::random(0, side)) *
+            affine3::rotation_y(random_double(0, 360));
+    printf("%d copies of %zu spheres\n", copies, cluster.objects.size());
+
+    double start = omp_get_wtime();
+    auto blas = build_wide_bvh<8>(cluster, 0, 1);
+    hittableList instances;
+    for (const auto &p : placements)
+        instances.add(make_shared<instance>(blas, p));
+    auto tlas = build_wide_bvh<8>(instances, 0, 1);
+    double two_level_ms = (omp_get_wtime() - start) * 1000;
+    size_t two_level_bytes =
+        (blas->nodes.size() + tlas->nodes.size()) * sizeof(WideBVHNode<8>) +
+        (blas->primitives.size() + tlas->primitives.size()) *
+            sizeof(shared_ptr<hittable>) +
+        cluster.objects.size() * sizeof(sphere) + copies * sizeof(instance);
+
+    start = omp_get_wtime();
+    hittableList flat;
+    for (const auto &p : placements)
+        for (const auto &c : centers)
+            flat.add(make_shared<sphere>(p.point(c), 10, white));
+    auto flat_bvh = build_wide_bvh<8>(flat, 0, 1);
+    double flat_ms = (omp_get_wtime() - start) * 1000;
+    size_t flat_bytes =
+        flat_bvh->nodes.size() * sizeof(WideBVHNode<8>) +
+        flat_bvh->primitives.size() * sizeof(shared_ptr<hittable>) +
+        flat.objects.size() * sizeof(sphere);
+
+    auto rays = bench_rays(*tlas, 200000);
+    TraceResult t2 = bench_trace(*tlas, rays);
+    TraceResult t1 = bench_trace(*flat_bvh, rays);
+    printf("%-10s %10s %10s %9s %9s %8s\n", "layout", "build(ms)", "MB",
+           "Mrays/s", "nodes/ray", "hits");
+    printf("%-10s %10.2lf %10.2lf %9.3lf %9.2lf %8d\n", "two-level",
+           two_level_ms, two_level_bytes / 1048576.0, t2.mrays,
+           t2.nodes_per_ray, t2.hits);
+    printf("%-10s %10.2lf %10.2lf %9.3lf %9.2lf %8d\n", "flat", flat_ms,
+           flat_bytes / 1048576.0, t1.mrays, t1.nodes_per_ray, t1.hits);
+}
+
+// 当前线程的硬件计数器, 内核不允许 (perf_event_paranoid) 或不支持时不可用
+class PerfCounter {
+public:
+    PerfCounter(uint32_t type, uint64_t config) {
+#ifdef __linux__
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+    ~PerfCounter() {
+#ifdef __linux__
+        if (fd >= 0)
+            close(fd);
+#endif
+    }
+    bool valid() const { return fd >= 0; }
+    void start() {
+#ifdef __linux__
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+    // 返回 start 之后的计数, 不可用时为 -1
+    long long stop() {
+        long long count = -1;
+#ifdef __linux__
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &count, sizeof(count)) != sizeof(count))
+                count = -1;
+        }
+#endif
+        return count;
+    }
+
+private:
+    int fd = -1;
+};
+
+// 大场景下比较深度优先布局与 treelet 布局
+// 硬件计数器给出整个遍历 (含物体求交) 的 L1D 读缺失与末级缓存缺失;
+// BVHCacheModel 只模拟节点访问, 计数器不可用时仍可比较布局
+void bench_layout(int size) {
+    int n = size > 0 ? size : 1000000;
+    auto objects = bench_spheres(n);
+    printf("scene spheres: %d primitives\n", n);
+    auto bvh = build_bvh(objects, 0, 1);
+    double start = omp_get_wtime();
+    TreeletBVH treelet(*bvh);
+    double layout_ms = (omp_get_wtime() - start) * 1000;
+    printf("treelet layout %.2lf ms, %d treelets, nodes %.2lf MB -> %.2lf MB\n",
+           layout_ms, treelet.treelets,
+           bvh->nodes.size() * sizeof(LinearBVHNode) / 1048576.0,
+           treelet.node_bytes() / 1048576.0);
+    auto rays = bench_rays(*bvh, 200000);
+
+#ifdef __linux__
+    PerfCounter l1(PERF_TYPE_HW_CACHE,
+                   PERF_COUNT_HW_CACHE_L1D |
+                       (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    PerfCounter llc(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+#else
+    PerfCounter l1(0, 0), llc(0, 0);
+#endif
+    if (!l1.valid() || !llc.valid())
+        printf("hardware cache counters unavailable, misses reported as "
+               "-1\n");
+
+    printf("%-12s %9s %9s %10s %10s %10s %10s %8s\n", "layout", "Mrays/s",
+           "nodes/ray", "line/ray", "page/ray", "L1D/ray", "LLC/ray",
+           "hits");
+    auto run = [&](const char *name, const hittable &world) {
+        // 先跑一遍预热, 再计数
+        bench_trace(world, rays);
+        l1.start();
+        llc.start();
+        TraceResult t = bench_trace(world, rays);
+        long long l1_miss = l1.stop(), llc_miss = llc.stop();
+        double lines = (double)bvh_counters().lineMisses / rays.size();
+        double pages = (double)bvh_counters().pageMisses / rays.size();
+        printf("%-12s %9.3lf %9.2lf %10.2lf %10.2lf %10.2lf %10.2lf %8d\n",
+               name, t.mrays, t.nodes_per_ray, lines, pages,
+               l1_miss < 0 ? -1.0 : (double)l1_miss / rays.size(),
+               llc_miss < 0 ? -1.0 : (double)llc_miss / rays.size(), t.hits);
+    };
+    run("depth-first", *bvh);
+    run("treelet", treelet);
+}
+
+// 量化节点与未压缩节点的内存和吞吐对比, 交点数应完全相同
+void bench_compress(int size) {
+    int n = size > 0 ? size : 1000000;
+    auto objects = bench_spheres(n);
+    printf("scene spheres: %d primitives\n", n);
+    auto bvh = build_bvh(objects, 0, 1);
+    WideBVH<4> wide4(*bvh);
+    WideBVH<8> wide8(*bvh);
+    double start = omp_get_wtime();
+    CompressedWideBVH<4> comp4(wide4);
+    CompressedWideBVH<8> comp8(wide8);
+    printf("compress %.2lf ms\n", (omp_get_wtime() - start) * 1000);
+    auto rays = bench_rays(*bvh, 200000);
+
+    size_t prims = bvh->primitives.size() * sizeof(shared_ptr<hittable>);
+    printf("%-14s %10s %10s %9s %9s %10s %8s\n", "layout", "nodes MB",
+           "total MB", "Mrays/s", "nodes/ray", "line/ray", "hits");
+    auto run = [&](const char *name, const hittable &world, size_t bytes) {
+        bench_trace(world, rays);
+        TraceResult t = bench_trace(world, rays);
+        printf("%-14s %10.2lf %10.2lf %9.3lf %9.2lf %10.2lf %8d\n", name,
+               bytes / 1048576.0, (bytes + prims) / 1048576.0, t.mrays,
+               t.nodes_per_ray,
+               (double)bvh_counters().lineMisses / rays.size(), t.hits);
+    };
+    run("binary", *bvh, bvh->nodes.size() * sizeof(LinearBVHNode));
+    run("wide4", wide4, wide4.nodes.size() * sizeof(WideBVHNode<4>));
+    run("compressed4", comp4, comp4.nodes.size() * sizeof(comp4.nodes[0]));
+    run("wide8", wide8, wide8.nodes.size() * sizeof(WideBVHNode<8>));
+    run("compressed8", comp8, comp8.nodes.size() * sizeof(comp8.nodes[0]));
+}
+
+// 首个像素前的等待时间: 完整构建与只建上层的延迟构建对比
+// 相机从场景包围盒外看向中心, 先追踪画面中央 32x32 的一块, 再追踪整帧
+void bench_lazy(const string &scene, int size) {
+    auto objects = bench_scene(scene, size > 0 ? size : 1000000);
+    printf("scene %s: %zu primitives\n", scene.c_str(),
+           objects.objects.size());
+    AABB box;
+    objects.bounding_box(0, 1, box);
+    vec3 center = 0.5 * (box.min() + box.max());
+    vec3 extent = box.max() - box.min();
+    camera cam(center - vec3(0, 0, 1.5 * extent.length()), center,
+               vec3(0, 1, 0), 40, 1, 0, 10, 0, 1);
+    const int tile = 32, width = 512;
+    vector<ray> first, frame;
+    for (int j = 0; j < tile; j++)
+        for (int i = 0; i < tile; i++)
+            first.push_back(cam.get_ray(0.5 + (i - tile / 2 + 0.5) / width,
+                                        0.5 + (j - tile / 2 + 0.5) / width));
+    for (int j = 0; j < width; j++)
+        for (int i = 0; i < width; i++)
+            frame.push_back(
+                cam.get_ray((i + 0.5) / width, (j + 0.5) / width));
+
+    printf("%-8s %10s %10s %10s %11s %10s %8s\n", "bvh", "build(ms)",
+           "tile(ms)", "first(ms)", "frame(ms)", "Mrays/s", "hits");
+    auto run = [&](const char *name, const hittable &world, double build) {
+        double start = omp_get_wtime();
+        bench_trace(world, first);
+        double tile_ms = (omp_get_wtime() - start) * 1000;
+        start = omp_get_wtime();
+        TraceResult cold = bench_trace(world, frame);
+        double frame_ms = (omp_get_wtime() - start) * 1000;
+        TraceResult warm = bench_trace(world, frame);
+        printf("%-8s %10.2lf %10.2lf %10.2lf %11.2lf %10.3lf %8d\n", name,
+               build, tile_ms, build + tile_ms, frame_ms, warm.mrays,
+               cold.hits);
+    };
+    double start = omp_get_wtime();
+    auto eager = build_bvh(objects, 0, 1);
+    run("eager", *eager, (omp_get_wtime() - start) * 1000);
+    start = omp_get_wtime();
+    auto lazy = build_lazy_bvh(objects, 0, 1);
+    double lazy_ms = (omp_get_wtime() - start) * 1000;
+    run("lazy", *lazy, lazy_ms);
+    printf("lazy subtrees built %d / %d, upper nodes %zu\n", lazy->built(),
+           lazy->subtree_count(), lazy->nodes.size());
+}
+
+// 同一组细分球面分别用独立的 Triangle 与共享顶点的 triangle_mesh 表示,
+// 对比内存、构建与遍历
+void bench_mesh(int size) {
+    int n = size > 0 ? size : 1000000;
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    const int stacks = 16, slices = 32;
+    int spheres = max(1, n / (2 * stacks * slices));
+    double side = 165.0 * cbrt(n / 1000.0);
+    vector<point3> positions;
+    vector<uint32_t> indices;
+    hittableList triangles;
+    for (int s = 0; s < spheres; s++) {
+        vec3 c = vec3::random(0, side);
+        double r = random_double(2, 8);
+        uint32_t base = positions.size();
+        for (int i = 0; i <= stacks; i++)
+            for (int j = 0; j <= slices; j++) {
+                double theta = M_PI * i / stacks, phi = 2 * M_PI * j / slices;
+                positions.push_back(c + r * vec3(sin(theta) * cos(phi),
+                                                 cos(theta),
+                                                 sin(theta) * sin(phi)));
+            }
+        auto at = [&](int i, int j) { return base + i * (slices + 1) + j; };
+        for (int i = 0; i < stacks; i++)
+            for (int j = 0; j < slices; j++) {
+                uint32_t quad[2][3] = {
+                    {at(i, j), at(i + 1, j), at(i + 1, j + 1)},
+                    {at(i, j), at(i + 1, j + 1), at(i, j + 1)}};
+                for (auto &f : quad) {
+                    indices.insert(indices.end(), f, f + 3);
+                    triangles.add(make_shared<Triangle>(
+                        positions[f[0]], positions[f[1]], positions[f[2]],
+                        white));
+                }
+            }
+    }
+    int faces = indices.size() / 3;
+    printf("scene meshes: %d spheres, %d triangles\n", spheres, faces);
+
+    double start = omp_get_wtime();
+    auto bvh = build_bvh(triangles, 0, 1);
+    double list_ms = (omp_get_wtime() - start) * 1000;
+    // make_shared 把控制块与对象放在一起, 另加列表中的指针
+    size_t list_bytes =
+        faces * (sizeof(Triangle) + 16 + 2 * sizeof(shared_ptr<hittable>)) +
+        bvh->nodes.size() * sizeof(LinearBVHNode);
+    start = omp_get_wtime();
+    triangle_mesh mesh(positions, indices, white);
+    double mesh_ms = (omp_get_wtime() - start) * 1000;
+    auto rays = bench_rays(*bvh, 200000);
+
+    printf("%-10s %10s %10s %10s %9s %8s\n", "geometry", "build(ms)",
+           "MB", "B/tri", "Mrays/s", "hits");
+    auto run = [&](const char *name, const hittable &world, double ms,
+                   size_t bytes) {
+        TraceResult t = bench_trace(world, rays);
+        printf("%-10s %10.2lf %10.2lf %10.1lf %9.3lf %8d\n", name, ms,
+               bytes / 1048576.0, (double)bytes / faces, t.mrays, t.hits);
+    };
+    run("triangles", *bvh, list_ms, list_bytes);
+    run("mesh", mesh, mesh_ms, mesh.memory_bytes());
+}
+
+// 三角形求交的微基准: 每条光线与每个三角形各测一次, 数据都在缓存中
+// 对比逐个调用 Triangle::hit 与预计算边的 4 路 TriangleBlock
+void bench_triangle_kernel(int size) {
+    int n = size > 0 ? size : 1024;
+    n = (n + TriangleBlock::Width - 1) / TriangleBlock::Width *
+        TriangleBlock::Width;
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    vector<Triangle> tris;
+    vector<TriangleBlock> blocks(n / TriangleBlock::Width);
+    for (int i = 0; i < n; i++) {
+        vec3 p = vec3::random(-1, 1);
+        tris.emplace_back(p, p + vec3::random(-0.5, 0.5),
+                          p + vec3::random(-0.5, 0.5), white);
+        if (i % TriangleBlock::Width == 0)
+            blocks[i / TriangleBlock::Width].clear();
+        blocks[i / TriangleBlock::Width].set(
+            i % TriangleBlock::Width, tris[i].p1, tris[i].p2, tris[i].p3, i);
+    }
+    vector<ray> rays(4096);
+    for (auto &r : rays)
+        r = ray(2.0 * random_unit_vector(), random_unit_vector());
+    double tests = (double)n * rays.size();
+    printf("%d triangles x %zu rays\n", n, rays.size());
+    printf("%-10s %12s %10s %8s\n", "kernel", "Mtests/s", "ns/test", "hits");
+
+    auto report = [&](const char *name, double seconds, long long hits) {
+        printf("%-10s %12.2lf %10.3lf %8lld\n", name, tests / seconds * 1e-6,
+               seconds / tests * 1e9, hits);
+    };
+    long long hits = 0;
+    double start = omp_get_wtime();
+    for (const auto &r : rays)
+        for (const auto &tri : tris) {
+            hit_record rec;
+            hits += tri.hit(r, 0.001, FLT_MAX, rec);
+        }
+    report("Triangle", omp_get_wtime() - start, hits);
+
+    hits = 0;
+    start = omp_get_wtime();
+    for (const auto &r : rays) {
+        block_ray br(r);
+        for (const auto &b : blocks) {
+            float t[4], u[4], v[4];
+            int mask = b.intersect(br, 0.001, FLT_MAX, t, u, v);
+            hits += __builtin_popcount(mask);
+        }
+    }
+    report("block4", omp_get_wtime() - start, hits);
+}
+
+// 生成约 n 个三角形的 OBJ: 带 v/vt/vn 与四边形面的细分球面,
+// 一半球面用绝对索引、一半用负数索引, 返回四边形数, 失败返回 0
+int write_bench_obj(const char *path, int n) {
+    const int stacks = 16, slices = 32;
+    int spheres = max(1, n / (2 * stacks * slices));
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "cannot write %s\n", path);
+        return 0;
+    }
+    long long base = 0;
+    for (int s = 0; s < spheres; s++) {
+        vec3 c = vec3::random(0, 1000);
+        for (int i = 0; i <= stacks; i++)
+            for (int j = 0; j <= slices; j++) {
+                double theta = M_PI * i / stacks, phi = 2 * M_PI * j / slices;
+                vec3 d(sin(theta) * cos(phi), cos(theta),
+                       sin(theta) * sin(phi));
+                vec3 p = c + 5 * d;
+                fprintf(f, "v %.6f %.6f %.6f\n", p.x(), p.y(), p.z());
+                fprintf(f, "vt %.6f %.6f\n", double(j) / slices,
+                        double(i) / stacks);
+                fprintf(f, "vn %.6f %.6f %.6f\n", d.x(), d.y(), d.z());
+            }
+        int count = (stacks + 1) * (slices + 1);
+        for (int i = 0; i < stacks; i++)
+            for (int j = 0; j < slices; j++) {
+                int q[4] = {i * (slices + 1) + j, (i + 1) * (slices + 1) + j,
+                            (i + 1) * (slices + 1) + j + 1,
+                            i * (slices + 1) + j + 1};
+                fprintf(f, "f");
+                for (int k : q) {
+                    long long id = s % 2 ? k - count : base + k + 1;
+                    fprintf(f, " %lld/%lld/%lld", id, id, id);
+                }
+                fprintf(f, "\n");
+            }
+        base += count;
+    }
+    fclose(f);
+    return spheres * stacks * slices;
+}
+
+// OBJ 读取: 与逐行 istringstream 解析对比
+void bench_obj(int size) {
+    const char *path = "bench_mesh.obj";
+    int quads = write_bench_obj(path, size > 0 ? size : 1000000);
+    if (!quads)
+        return;
+    mapped_file file(path);
+    double mb = file.size() / 1048576.0;
+    printf("%s: %.1lf MB, %d quads\n", path, mb, quads);
+
+    // 与 GPU 端 readObj 相同的逐行 istringstream 解析, 只读位置与面
+    double start = omp_get_wtime();
+    {
+        std::ifstream fin(path);
+        string line;
+        vector<vec3> v;
+        vector<int> faces;
+        while (std::getline(fin, line)) {
+            std::istringstream sin(line);
+            string type;
+            sin >> type;
+            if (type == "v") {
+                double x, y, z;
+                sin >> x >> y >> z;
+                v.push_back(vec3(x, y, z));
+            } else if (type == "f") {
+                string corner;
+                while (sin >> corner)
+                    faces.push_back(atoi(corner.c_str()));
+            }
+        }
+        double ms = (omp_get_wtime() - start) * 1000;
+        printf("%-12s %10.2lf ms %9.1lf MB/s %9zu vertices\n", "istringstream",
+               ms, mb / ms * 1000, v.size());
+    }
+
+    mesh_data data;
+    start = omp_get_wtime();
+    read_obj(path, data);
+    double ms = (omp_get_wtime() - start) * 1000;
+    printf("%-12s %10.2lf ms %9.1lf MB/s %9zu vertices %9zu triangles\n",
+           "read_obj", ms, mb / ms * 1000, data.positions.size(),
+           data.indices.size() / 3);
+    start = omp_get_wtime();
+    auto mesh = make_shared<triangle_mesh>(
+        std::move(data.positions), std::move(data.indices),
+        make_shared<lambertian>(color(.73, .73, .73)), std::move(data.normals),
+        std::move(data.uvs));
+    printf("%-12s %10.2lf ms\n", "mesh BVH", (omp_get_wtime() - start) * 1000);
+    remove(path);
+}
+
+// 网格缓存: 冷启动读取 OBJ 并构建 BVH, 与读取带 BVH 的二进制缓存对比
+void bench_cache(int size) {
+    const char *path = "bench_cache.obj";
+    string cache_path = string(path) + ".rtmesh";
+    if (!write_bench_obj(path, size > 0 ? size : 1000000))
+        return;
+    remove(cache_path.c_str());
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    printf("%-12s %10s %10s %10s\n", "load", "ms", "MB", "triangles");
+    auto report = [&](const char *name, const string &file_path, double ms,
+                      const shared_ptr<triangle_mesh> &mesh) {
+        mapped_file file(file_path);
+        printf("%-12s %10.2lf %10.1lf %10d\n", name, ms,
+               file.size() / 1048576.0, mesh ? mesh->face_count() : 0);
+    };
+
+    double start = omp_get_wtime();
+    auto cold = load_obj(path, white);
+    report("obj", path, (omp_get_wtime() - start) * 1000, cold);
+    start = omp_get_wtime();
+    bool ok = convert_obj(path, cache_path);
+    printf("%-12s %10.2lf\n", "convert", (omp_get_wtime() - start) * 1000);
+    if (!ok || !cold)
+        return;
+    start = omp_get_wtime();
+    auto warm = load_mesh(path, white);
+    report("cache", cache_path, (omp_get_wtime() - start) * 1000, warm);
+
+    // 两种方式得到的网格必须一致
+    auto rays = bench_rays(*cold, 200000);
+    TraceResult a = bench_trace(*cold, rays), b = bench_trace(*warm, rays);
+    printf("hits: obj %d, cache %d\n", a.hits, b.hits);
+    remove(path);
+    remove(cache_path.c_str());
+}
+
+// 原先由 6 个 Rect 与 3 个 flip_face 拼成的盒子, 作为 box 的对照
+shared_ptr<hittable> rect_box(const vec3 &p0, const vec3 &p1,
+                              shared_ptr<material> m) {
+    double x0 = p0.x(), y0 = p0.y(), z0 = p0.z();
+    double x1 = p1.x(), y1 = p1.y(), z1 = p1.z();
+    auto sides = make_shared<hittableList>();
+    sides->add(make_shared<Rect<XY>>(x0, x1, y0, y1, z1, m));
+    sides->add(
+        make_shared<flip_face>(make_shared<Rect<XY>>(x0, x1, y0, y1, z0, m)));
+    sides->add(make_shared<Rect<XZ>>(x0, x1, z0, z1, y1, m));
+    sides->add(
+        make_shared<flip_face>(make_shared<Rect<XZ>>(x0, x1, z0, z1, y0, m)));
+    sides->add(make_shared<Rect<YZ>>(y0, y1, z0, z1, x1, m));
+    sides->add(
+        make_shared<flip_face>(make_shared<Rect<YZ>>(y0, y1, z0, z1, x0, m)));
+    return sides;
+}
+
+// 解析盒子与 Rect 拼成的盒子对比: Cornell box 中两个旋转的盒子,
+// 以及 final_scene 的 size x size 个地面盒子 (各自建 BVH)
+void bench_box(int size) {
+    int n = size > 0 ? size : 20;
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    hittableList cornell_rects, cornell_boxes;
+    struct {
+        vec3 size, offset;
+        double angle;
+    } placed[2] = {{vec3(165, 330, 165), vec3(265, 0, 295), 15},
+                   {vec3(165, 165, 165), vec3(130, 0, 65), -18}};
+    for (auto &b : placed) {
+        shared_ptr<hittable> h = rect_box(vec3(0, 0, 0), b.size, white);
+        h = make_shared<rotate_y>(h, b.angle);
+        cornell_rects.add(make_shared<translate>(h, b.offset));
+        cornell_boxes.add(make_shared<box>(
+            vec3(0, 0, 0), b.size, white,
+            affine3::translation(b.offset) * affine3::rotation_y(b.angle)));
+    }
+
+    hittableList ground_rects, ground_boxes;
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < n; j++) {
+            vec3 p0(-1000.0 + i * 100, 0, -1000.0 + j * 100);
+            vec3 p1 = p0 + vec3(100, random_double(1, 101), 100);
+            ground_rects.add(rect_box(p0, p1, white));
+            ground_boxes.add(make_shared<box>(p0, p1, white));
+        }
+    auto ground_rect_bvh = build_bvh(ground_rects, 0, 1);
+    auto ground_box_bvh = build_bvh(ground_boxes, 0, 1);
+
+    printf("%-14s %9s %8s\n", "scene", "Mrays/s", "hits");
+    auto run = [&](const char *name, const hittable &world,
+                   const vector<ray> &rays) {
+        TraceResult t = bench_trace(world, rays);
+        printf("%-14s %9.3lf %8d\n", name, t.mrays, t.hits);
+    };
+    auto rays = bench_rays(cornell_boxes, 1000000);
+    run("cornell rects", cornell_rects, rays);
+    run("cornell box", cornell_boxes, rays);
+    rays = bench_rays(*ground_box_bvh, 1000000);
+    run("ground rects", *ground_rect_bvh, rays);
+    run("ground box", *ground_box_bvh, rays);
+}
+
+int main(int argc, char **argv) {
+    string mode = argc > 1 ? argv[1] : "build";
+    string scene = argc > 2 ? argv[2] : "spheres";
+    int size = argc > 3 ? atoi(argv[3]) : 0;
+
+    if (mode == "build")
+        bench_build(scene, size);
+    else if (mode == "threads")
+        bench_threads(scene, size);
+    else if (mode == "slab")
+        bench_slab();
+    else if (mode == "shadow")
+        bench_shadow(scene, size);
+    else if (mode == "refit")
+        bench_refit(argc > 2 ? atoi(argv[2]) : 0);
+    else if (mode == "motion")
+        bench_motion(argc > 2 ? atoi(argv[2]) : 0);
+    else if (mode == "instance")
+        bench_instance(argc > 2 ? atoi(argv[2]) : 0);
+    else if (mode == "layout")
+        bench_layout(argc > 2 ? atoi(argv[2]) : 0);
+    else if (mode == "compress")
+        bench_compress(argc > 2 ? atoi(argv[2]) : 0);
+    else if (mode == "lazy")
+        bench_lazy(scene, size);
+    else if (mode == "mesh")
+        bench_mesh(argc > 2 ? atoi(argv[2]) : 0);
+    else if (mode == "tri")
+        bench_triangle_kernel(argc > 2 ? atoi(argv[2]) : 0);
+    else if (mode == "obj")
+        bench_obj(argc > 2 ? atoi(argv[2]) : 0);
+    else if (mode == "cache")
+        bench_cache(argc > 2 ? atoi(argv[2]) : 0);
+    else if (mode == "box")
+        bench_box(argc > 2 ? atoi(argv[2]) : 0);
+    else {
+        fprintf(stderr,
+                "usage: %s build|threads|slab|shadow|refit|motion|instance|"
+                "layout|compress|lazy|mesh|tri|obj|cache|box [scene] [size]\n",
+                argv[0]);
+        return 1;
+    }
+    return 0;
+}
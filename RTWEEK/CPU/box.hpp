@@ -5,47 +5,159 @@
 #ifndef RAYTRACE_BOX_HPP
 #define RAYTRACE_BOX_HPP
 
-#include "rect.hpp"
+#include "./AABB.hpp"
+#include "./Instance.hpp"
+#include "./hittable.hpp"
+#include "./ray.hpp"
+#include "./vec3.hpp"
+#include <cfloat>
 
+// 长方体: 物体空间中为轴对齐的 [p0, p1], 可选一个仿射变换摆放到世界空间
+// 求交只做一次 slab 测试, 由进入 (起点在盒内时为射出) 的轴得到
+// 法线、UV 与面编号; 面编号为 2 * 轴 + (是否为坐标较大的一侧),
+// UV 与原先拼成盒子的 Rect 一致
 class box : public hittable {
 public:
     box() {}
     box(const vec3 &p0, const vec3 &p1, shared_ptr<material> ptr);
+    // to_world 把物体空间的盒子变换到世界空间, 代替 rotate_y 与 translate
+    box(const vec3 &p0, const vec3 &p1, shared_ptr<material> ptr,
+        const affine3 &to_world);
 
-    virtual bool hit(const ray &r, float t0, float t1, hit_record &rec) const;
+    virtual bool hit(const ray &r, float t0, float t1,
+                     hit_record &rec) const override;
+    virtual bool occluded(const ray &r, float t0, float t1) const override;
+    virtual void all_hits(const ray &r, float t0, float t1,
+                          hit_collector &out) const override;
 
-    virtual bool bounding_box(float t0, float t1, AABB &output_box) const {
-        output_box = AABB(box_min, box_max);
+    virtual bool bounding_box(float t0, float t1,
+                              AABB &output_box) const override {
+        output_box = bbox;
         return true;
     }
 
 public:
-    vec3 box_min;
+    vec3 box_min; // 物体空间
     vec3 box_max;
-    hittableList sides;
-};
+    shared_ptr<material> mp;
+    bool oriented = false;
+    affine3 object_to_world;
+    affine3 world_to_object; // 构造时求逆并缓存
 
-box::box(const vec3 &p0, const vec3 &p1, shared_ptr<material> ptr) {
-    box_min = p0;
-    box_max = p1;
+private:
+    // 方向不归一化, 两个空间中的 t 相同
+    ray to_object(const ray &r) const {
+        if (!oriented)
+            return r;
+        return ray(world_to_object.point(r.origin()),
+                   world_to_object.direction(r.direction()), r.time());
+    }
+    // 物体空间的 slab 测试, 给出光线在盒内的区间及区间两端所在的轴
+    bool slab(const ray &r, double &t_near, double &t_far, int &near_axis,
+              int &far_axis) const;
 
-    sides.add(
-        make_shared<Rect<XY>>(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr));
-    sides.add(make_shared<flip_face>(
-        make_shared<Rect<XY>>(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ptr)));
+    AABB bbox; // 世界空间包围盒
+};
 
-    sides.add(
-        make_shared<Rect<XZ>>(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), ptr));
-    sides.add(make_shared<flip_face>(
-        make_shared<Rect<XZ>>(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), ptr)));
+box::box(const vec3 &p0, const vec3 &p1, shared_ptr<material> ptr)
+    : box_min(p0), box_max(p1), mp(ptr), bbox(p0, p1) {}
 
-    sides.add(
-        make_shared<Rect<YZ>>(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), ptr));
-    sides.add(make_shared<flip_face>(
-        make_shared<Rect<YZ>>(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), ptr)));
+box::box(const vec3 &p0, const vec3 &p1, shared_ptr<material> ptr,
+         const affine3 &to_world)
+    : box_min(p0), box_max(p1), mp(ptr), oriented(true),
+      object_to_world(to_world), world_to_object(to_world.inverse()) {
+    // 变换物体空间包围盒的 8 个角点
+    vec3 lo(DBL_MAX, DBL_MAX, DBL_MAX), hi(-DBL_MAX, -DBL_MAX, -DBL_MAX);
+    for (int i = 0; i < 8; i++) {
+        vec3 corner((i & 1 ? p1 : p0).x(), (i & 2 ? p1 : p0).y(),
+                    (i & 4 ? p1 : p0).z());
+        vec3 p = object_to_world.point(corner);
+        for (int a = 0; a < 3; a++) {
+            lo[a] = fmin(lo[a], p[a]);
+            hi[a] = fmax(hi[a], p[a]);
+        }
+    }
+    bbox = AABB(lo, hi);
+}
+
+bool box::slab(const ray &r, double &t_near, double &t_far, int &near_axis,
+               int &far_axis) const {
+    t_near = -DBL_MAX;
+    t_far = DBL_MAX;
+    near_axis = far_axis = 0;
+    for (int a = 0; a < 3; a++) {
+        double o = r.origin()[a], d = r.direction()[a];
+        if (d == 0) {
+            // 与这对面平行, 起点在两面之间才可能相交
+            if (o < box_min[a] || o > box_max[a])
+                return false;
+            continue;
+        }
+        double t0 = (box_min[a] - o) / d, t1 = (box_max[a] - o) / d;
+        if (d < 0)
+            swap(t0, t1);
+        if (t0 > t_near) {
+            t_near = t0;
+            near_axis = a;
+        }
+        if (t1 < t_far) {
+            t_far = t1;
+            far_axis = a;
+        }
+    }
+    return t_near <= t_far;
 }
 
 bool box::hit(const ray &r, float t0, float t1, hit_record &rec) const {
-    return sides.hit(r, t0, t1, rec);
+    ray local = to_object(r);
+    double t_near, t_far;
+    int near_axis, far_axis;
+    if (!slab(local, t_near, t_far, near_axis, far_axis))
+        return false;
+    // 进入点在查询区间之前 (起点在盒内或在表面上) 时取射出点
+    bool exiting = t_near < t0;
+    double t = exiting ? t_far : t_near;
+    int a = exiting ? far_axis : near_axis;
+    if (t < t0 || t > t1)
+        return false;
+
+    // 进入的面法向与方向相反, 射出的面法向与方向相同
+    bool upper = (local.direction()[a] > 0) == exiting;
+    vec3 p = local.point_at(t);
+    int ua = a == 0 ? 1 : 0, va = a == 2 ? 1 : 2;
+    rec.u = (p[ua] - box_min[ua]) / (box_max[ua] - box_min[ua]);
+    rec.v = (p[va] - box_min[va]) / (box_max[va] - box_min[va]);
+    rec.face = 2 * a + upper;
+    rec.t = t;
+    rec.p = r.point_at(t);
+    rec.mat_ptr = mp;
+    vec3 outward_normal(0, 0, 0);
+    outward_normal[a] = upper ? 1 : -1;
+    if (oriented)
+        outward_normal =
+            unit_vector(world_to_object.transposed_direction(outward_normal));
+    rec.set_face_normal(r, outward_normal);
+    return true;
+}
+
+bool box::occluded(const ray &r, float t0, float t1) const {
+    double t_near, t_far;
+    int near_axis, far_axis;
+    if (!slab(to_object(r), t_near, t_far, near_axis, far_axis))
+        return false;
+    return (t_near >= t0 && t_near <= t1) || (t_far >= t0 && t_far <= t1);
 }
+
+void box::all_hits(const ray &r, float t0, float t1,
+                   hit_collector &out) const {
+    double t_near, t_far;
+    int near_axis, far_axis;
+    if (!slab(to_object(r), t_near, t_far, near_axis, far_axis))
+        return;
+    if (t_near >= t0 && t_near <= t1)
+        out.add(t_near, this, true);
+    if (t_far >= t0 && t_far <= t1)
+        out.add(t_far, this, false);
+}
+
 #endif // RAYTRACE_BOX_HPP
@@ -35,11 +35,20 @@ bool constant_medium::hit(const ray &r, float t_min, float t_max,
 
     hit_record rec1, rec2;
 
-    if (!boundary->hit(r, FLT_MIN, FLT_MAX, rec1))
+    // 一次遍历取边界上最近的几个交点作为进入/离开点
+    // 起点可能在介质内, 从 -FLT_MAX 开始收集; 由矩形拼成的边界在棱上会
+    // 重复报告同一交点, 离开点取第一个与进入点拉开距离的交点
+    hit_collector hits(3);
+    boundary->all_hits(r, -FLT_MAX, FLT_MAX, hits);
+    if (hits.count < 2)
         return false;
-
-    if (!boundary->hit(r, rec1.t + 0.0001, FLT_MAX, rec2))
+    rec1.t = hits.hits[0].t;
+    int exit = 1;
+    while (exit < hits.count && hits.hits[exit].t < rec1.t + 0.0001f)
+        exit++;
+    if (exit == hits.count)
         return false;
+    rec2.t = hits.hits[exit].t;
 
     if (debugging)
         std::cerr << "\nt0=" << rec1.t << ", t1=" << rec2.t << '\n';
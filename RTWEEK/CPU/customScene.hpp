@@ -9,13 +9,17 @@
 #include "./sphere.hpp"
 #define STB_IMAGE_IMPLEMENTATION
 
+#include "./WideBVH.hpp"
+#include "./Instance.hpp"
+#include "./MotionBVH.hpp"
 #include "./Triangle.hpp"
 #include "./box.hpp"
 #include "./constant_medium.hpp"
 #include "./lib/stb_image.h"
 #include "./rect.hpp"
 
-hittableList random_scene() {
+// random_scene 的物体, 不建 BVH; half 控制小球网格的半边长
+hittableList random_scene_objects(int half = 5) {
     hittableList world;
     auto checker = make_shared<checker_texture>(
         make_shared<constant_texture>(vec3(0.2, 0.3, 0.1)),
@@ -25,8 +29,8 @@ hittableList random_scene() {
                                   make_shared<lambertian>(checker)));
 
     int i = 1;
-    for (int a = -5; a < 5; a++) {
-        for (int b = -5; b < 5; b++) {
+    for (int a = -half; a < half; a++) {
+        for (int b = -half; b < half; b++) {
             auto choose_mat = random_double();
             vec3 center(a + 0.9 * random_double(), 0.2,
                         b + 0.9 * random_double());
@@ -62,7 +66,13 @@ hittableList random_scene() {
             make_shared<constant_texture>(vec3(0.4, 0.2, 0.1)))));
     world.add(make_shared<sphere>(
         vec3(4, 1, 0), 1.0, make_shared<metal>(vec3(0.7, 0.6, 0.5), 0.0)));
-    auto test = static_cast<hittableList>(make_shared<BVHNode>(world, 0, 1));
+    return world;
+}
+
+hittableList random_scene() {
+    auto world = random_scene_objects();
+    // 漫反射小球在快门内移动, 用按光线时刻插值包围盒的运动 BVH
+    auto test = hittableList(build_motion_bvh(world, 0, 1));
     printf("BVH Done\n");
     return test;
 }
@@ -166,15 +176,12 @@ hittableList cornell_smoke() {
     objects.add(make_shared<Rect<XZ>>(0, 555, 0, 555, 0, white));
     objects.add(make_shared<Rect<XY>>(0, 555, 0, 555, 555, white));
 
-    shared_ptr<hittable> box1 =
-        make_shared<box>(vec3(0, 0, 0), vec3(165, 330, 165), white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-
-    shared_ptr<hittable> box2 =
-        make_shared<box>(vec3(0, 0, 0), vec3(165, 165, 165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130, 0, 65));
+    auto box1 = make_shared<box>(
+        vec3(0, 0, 0), vec3(165, 330, 165), white,
+        affine3::translation(vec3(265, 0, 295)) * affine3::rotation_y(15));
+    auto box2 = make_shared<box>(
+        vec3(0, 0, 0), vec3(165, 165, 165), white,
+        affine3::translation(vec3(130, 0, 65)) * affine3::rotation_y(-18));
 
     objects.add(make_shared<constant_medium>(
         box1, 0.01, make_shared<constant_texture>(vec3(0, 0, 0))));
@@ -207,7 +214,7 @@ hittableList final_scene() {
 
     hittableList objects;
 
-    objects.add(make_shared<BVHNode>(boxes1, 0, 1));
+    objects.add(build_wide_bvh<8>(boxes1, 0, 1));
 
     auto light = make_shared<diffuse_light>(
         make_shared<constant_texture>(vec3(7, 7, 7)));
@@ -253,9 +260,10 @@ hittableList final_scene() {
         boxes2.add(make_shared<sphere>(vec3::random(0, 165), 10, white));
     }
 
-    objects.add(make_shared<translate>(
-        make_shared<rotate_y>(make_shared<BVHNode>(boxes2, 0.0, 1.0), 15),
-        vec3(-100, 270, 395)));
+    // 球团的 BVH 只建一次, 通过实例变换摆放
+    objects.add(make_shared<instance>(
+        build_wide_bvh<8>(boxes2, 0.0, 1.0),
+        affine3::translation(vec3(-100, 270, 395)) * affine3::rotation_y(15)));
 
     return objects;
 }
@@ -276,17 +284,12 @@ hittableList cornell_box() {
     objects.add(make_shared<Rect<XZ>>(0, 555, 0, 555, 0, white));
     objects.add(make_shared<Rect<XY>>(0, 555, 0, 555, 555, white));
 
-    shared_ptr<hittable> box1 =
-        make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-    objects.add(box1);
-
-    shared_ptr<hittable> box2 =
-        make_shared<box>(point3(0, 0, 0), point3(165, 165, 165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130, 0, 65));
-    objects.add(box2);
+    objects.add(make_shared<box>(
+        point3(0, 0, 0), point3(165, 330, 165), white,
+        affine3::translation(vec3(265, 0, 295)) * affine3::rotation_y(15)));
+    objects.add(make_shared<box>(
+        point3(0, 0, 0), point3(165, 165, 165), white,
+        affine3::translation(vec3(130, 0, 65)) * affine3::rotation_y(-18)));
 
     return objects;
 }
@@ -308,11 +311,9 @@ hittableList test_cornell_box() {
 
     shared_ptr<material> aluminum =
         make_shared<lambertian>(color(0.8, 0.85, 0.88));
-    shared_ptr<hittable> box1 =
-        make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), aluminum);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-    objects.add(box1);
+    objects.add(make_shared<box>(
+        point3(0, 0, 0), point3(165, 330, 165), aluminum,
+        affine3::translation(vec3(265, 0, 295)) * affine3::rotation_y(15)));
 
     auto glass = make_shared<dielectric>(1.5);
     objects.add(make_shared<sphere>(point3(190, 90, 190), 90, glass));
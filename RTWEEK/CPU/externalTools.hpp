@@ -5,9 +5,11 @@
 #ifndef RAYTRACE_EXTERNALTOOLS_HPP
 #define RAYTRACE_EXTERNALTOOLS_HPP
 
+#include "./sampler.hpp"
 #include "./vec3.hpp"
+#include <cstdint>
+#include <cstring>
 #include <numbers>
-#include <random>
 
 using namespace std;
 
@@ -63,29 +65,29 @@ constexpr inline long double operator"" _rad_to_deg(long double rad) {
 }
 
 inline double InvSqrt(double number) {
-    long long i;
+    int64_t i;
     double x2, y;
     const double threehalfs = 1.5F;
 
     x2 = number * 0.5F;
     y = number;
-    i = *(long long *)&y;
+    memcpy(&i, &y, sizeof(i));
     i = 0x5fe6ec85e7de30da - (i >> 1);
-    y = *(double *)&i;
+    memcpy(&y, &i, sizeof(y));
     y = y * (threehalfs - (x2 * y * y)); // 1st iteration
     y = y * (threehalfs - (x2 * y * y)); // 2nd iteration, this can be removed
     return y;
 }
 inline float InvSqrt(float number) {
-    long i;
+    int32_t i; // long 在 LP64 下是 8 字节, 会读到 float 之外的内存
     float x2, y;
     const float threehalfs = 1.5F;
 
     x2 = number * 0.5F;
     y = number;
-    i = *(long *)&y; // evil floating point bit level hacking
+    memcpy(&i, &y, sizeof(i)); // evil floating point bit level hacking
     i = 0x5f3759df - (i >> 1);
-    y = *(float *)&i;
+    memcpy(&y, &i, sizeof(y));
     y = y * (threehalfs - (x2 * y * y)); // 1st iteration
     y = y * (threehalfs - (x2 * y * y));
     return y;
@@ -115,16 +117,9 @@ inline float atanFast4(float inX) {
     return x * (-0.1784f * abs(x) - 0.0663f * x * x + 1.0301f);
 }
 
-static double get_random() { //[0,1)
-    random_device rd;
-    mt19937 mt(rd());
-    uniform_real_distribution<double> dist(0.0, 1.0);
-    return dist(mt);
-}
-
 inline double random_double() {
     // Returns a random real in [0,1).
-    return rand() / (RAND_MAX + 1.0);
+    return thread_sampler().next_1d();
 }
 
 inline int random_int(int min, int max) {
@@ -22,6 +22,7 @@ struct hit_record {
     float t, u, v;
     shared_ptr<material> mat_ptr;
     bool front_face;
+    int face = 0; // 图元内被击中的面, 如 box 的 6 个面
 
     inline void set_face_normal(const ray &r, const vec3 &outward_normal) {
         front_face = dot(r.direction(), outward_normal) < 0;
@@ -29,11 +30,76 @@ struct hit_record {
     }
 };
 
+class hittable;
+
+// 多交点查询中的一个交点, 只记录距离、所属物体与正反面
+struct surface_hit {
+    float t;
+    const hittable *prim;
+    bool front_face;
+};
+
+// 收集光线上最近的 k 个交点, 按 t 升序保存
+// 收满后第 k 个交点的距离即可用来剔除更远的子树
+class hit_collector {
+public:
+    static const int MaxHits = 16;
+
+    explicit hit_collector(int k = 2) : k(k < MaxHits ? k : MaxHits) {}
+
+    // 超过该距离的交点不会再被收集
+    float bound(float t_max) const {
+        return count < k || t_max < hits[k - 1].t ? t_max : hits[k - 1].t;
+    }
+
+    // 空间划分 (SBVH) 会把同一物体放进多个叶节点, 重复的交点只记一次
+    void add(float t, const hittable *prim, bool front_face) {
+        if (count == k && t >= hits[k - 1].t)
+            return;
+        for (int j = 0; j < count; j++)
+            if (hits[j].prim == prim && hits[j].t == t)
+                return;
+        int i = count < k ? count++ : k - 1;
+        for (; i > 0 && hits[i - 1].t > t; i--)
+            hits[i] = hits[i - 1];
+        hits[i] = {t, prim, front_face};
+    }
+
+    int k;
+    int count = 0;
+    surface_hit hits[MaxHits];
+};
+
 class hittable {
 public:
     virtual bool hit(const ray &r, float t_min, float t_max,
                      hit_record &rec) const = 0;
     virtual bool bounding_box(float t0, float t1, AABB &box) const = 0;
+    // 任意交点查询: [t_min, t_max] 内有交点即返回, 不计算着色数据
+    // 默认退化为最近交点查询, 几何体和加速结构应提供更快的实现
+    virtual bool occluded(const ray &r, float t_min, float t_max) const {
+        hit_record rec;
+        return hit(r, t_min, t_max, rec);
+    }
+    // 多交点查询: 把 [t_min, t_max] 内的交点加入 out, 只保留最近的 k 个
+    // 默认反复调用 hit, 每次从上一个交点之后继续, 几何体应提供解析实现
+    virtual void all_hits(const ray &r, float t_min, float t_max,
+                          hit_collector &out) const {
+        hit_record rec;
+        while (hit(r, t_min, out.bound(t_max), rec)) {
+            out.add(rec.t, this, rec.front_face);
+            t_min = rec.t + 0.0001f;
+        }
+    }
+    // 物体落在 clip 内的部分的包围盒, 供空间划分 (SBVH) 裁剪引用
+    // 默认取包围盒与 clip 的交集, 三角形等可以给出更紧的结果
+    virtual bool clipped_bounding_box(const AABB &clip, float t0, float t1,
+                                      AABB &output_box) const {
+        if (!bounding_box(t0, t1, output_box))
+            return false;
+        output_box = overlap_box(output_box, clip);
+        return true;
+    }
     virtual double pdf_value(const point3 &o, const vec3 &v) const {
         return 0.0;
     }
@@ -49,6 +115,10 @@ public:
     void add(shared_ptr<hittable> object) { objects.push_back(object); }
     virtual bool hit(const ray &r, float t_min, float t_max,
                      hit_record &rec) const override;
+    virtual bool occluded(const ray &r, float t_min,
+                          float t_max) const override;
+    virtual void all_hits(const ray &r, float t_min, float t_max,
+                          hit_collector &out) const override;
     virtual bool bounding_box(float time0, float time1,
                               AABB &output_box) const override;
     virtual double pdf_value(const vec3 &o, const vec3 &v) const override;
@@ -71,6 +141,19 @@ bool hittableList::hit(const ray &r, float t_min, float t_max,
     return is_hit;
 }
 
+bool hittableList::occluded(const ray &r, float t_min, float t_max) const {
+    for (const auto &object : objects)
+        if (object->occluded(r, t_min, t_max))
+            return true;
+    return false;
+}
+
+void hittableList::all_hits(const ray &r, float t_min, float t_max,
+                            hit_collector &out) const {
+    for (const auto &object : objects)
+        object->all_hits(r, t_min, out.bound(t_max), out);
+}
+
 bool hittableList::bounding_box(float t0, float t1, AABB &output_box) const {
     if (objects.empty())
         return false;
@@ -115,6 +198,19 @@ public:
         return true;
     }
 
+    virtual bool occluded(const ray &r, float t_min, float t_max) const {
+        return ptr->occluded(r, t_min, t_max);
+    }
+
+    virtual void all_hits(const ray &r, float t_min, float t_max,
+                          hit_collector &out) const {
+        hit_collector flipped(out.k);
+        ptr->all_hits(r, t_min, out.bound(t_max), flipped);
+        for (int i = 0; i < flipped.count; i++)
+            out.add(flipped.hits[i].t, flipped.hits[i].prim,
+                    !flipped.hits[i].front_face);
+    }
+
     virtual bool bounding_box(float t0, float t1, AABB &output_box) const {
         return ptr->bounding_box(t0, t1, output_box);
     }
@@ -130,6 +226,15 @@ public:
 
     virtual bool hit(const ray &r, float t_min, float t_max,
                      hit_record &rec) const;
+    virtual bool occluded(const ray &r, float t_min, float t_max) const {
+        ray moved_r(r.origin() - offset, r.direction(), r.time());
+        return ptr->occluded(moved_r, t_min, t_max);
+    }
+    virtual void all_hits(const ray &r, float t_min, float t_max,
+                          hit_collector &out) const {
+        ray moved_r(r.origin() - offset, r.direction(), r.time());
+        ptr->all_hits(moved_r, t_min, t_max, out);
+    }
     virtual bool bounding_box(float t0, float t1, AABB &output_box) const;
 
 public:
@@ -162,8 +267,18 @@ public:
 
     virtual bool hit(const ray &r, float t_min, float t_max,
                      hit_record &rec) const;
+    virtual bool occluded(const ray &r, float t_min, float t_max) const {
+        return ptr->occluded(to_object(r), t_min, t_max);
+    }
+    virtual void all_hits(const ray &r, float t_min, float t_max,
+                          hit_collector &out) const {
+        ptr->all_hits(to_object(r), t_min, t_max, out);
+    }
     virtual bool bounding_box(float t0, float t1, AABB &output_box) const;
 
+    // 世界空间的光线转到物体空间
+    ray to_object(const ray &r) const;
+
 public:
     shared_ptr<hittable> ptr;
     double sin_theta;
@@ -181,6 +296,11 @@ rotate_y::rotate_y(shared_ptr<hittable> p, double angle) : ptr(p) {
     auto radians = degrees_to_radians(angle);
     sin_theta = fast_sinf(radians);
     cos_theta = fast_cosf(radians);
+    // 近似的 sin/cos 平方和不为 1, 往返变换后交点会偏离表面;
+    // 归一化使旋转正交, 否则从交点出发的光线会与同一个面自交
+    double norm = sqrt(sin_theta * sin_theta + cos_theta * cos_theta);
+    sin_theta /= norm;
+    cos_theta /= norm;
     hasbox = ptr->bounding_box(0, 1, bbox);
 
     vec3 min(DBL_MAX, DBL_MAX, DBL_MAX);
@@ -209,8 +329,7 @@ rotate_y::rotate_y(shared_ptr<hittable> p, double angle) : ptr(p) {
     bbox = AABB(min, max);
 }
 
-bool rotate_y::hit(const ray &r, float t_min, float t_max,
-                   hit_record &rec) const {
+ray rotate_y::to_object(const ray &r) const {
     vec3 origin = r.origin();
     vec3 direction = r.direction();
 
@@ -220,7 +339,12 @@ bool rotate_y::hit(const ray &r, float t_min, float t_max,
     direction[0] = cos_theta * r.direction()[0] - sin_theta * r.direction()[2];
     direction[2] = sin_theta * r.direction()[0] + cos_theta * r.direction()[2];
 
-    ray rotated_r(origin, direction, r.time());
+    return ray(origin, direction, r.time());
+}
+
+bool rotate_y::hit(const ray &r, float t_min, float t_max,
+                   hit_record &rec) const {
+    ray rotated_r = to_object(r);
 
     if (!ptr->hit(rotated_r, t_min, t_max, rec))
         return false;
@@ -0,0 +1,203 @@
+#ifndef RAYTRACE_INTEGRATOR_HPP
+#define RAYTRACE_INTEGRATOR_HPP
+
+#include "./PDF.hpp"
+#include "./externalTools.hpp"
+#include "./hittable.hpp"
+#include "./material.hpp"
+#include "./ray.hpp"
+#include <cfloat>
+#include <cstdint>
+
+using namespace std;
+
+// 可选的积分器
+enum IntegratorType { RECURSIVE, PATH, AO };
+
+struct integrator_options {
+    int max_depth = 5; // RECURSIVE: 最大弹射次数; PATH: 安全上限
+    int rr_min_depth = 3; // PATH: 从该深度开始俄罗斯轮盘
+    int split_count = 1; // PATH: 首次漫反射处分裂出的路径数
+    int ao_samples = 16; // AO: 每个交点的遮挡光线数
+    double ao_distance = 100; // AO: 遮挡光线的最大长度
+};
+
+class integrator {
+public:
+    integrator(const hittable &world, shared_ptr<hittable> lights,
+               const color &background, const integrator_options &opts)
+        : world(world), lights(lights), background(background), opts(opts) {}
+    virtual ~integrator() {}
+
+    // 返回沿相机光线 r 到达的辐亮度, rays 累加追踪的光线段数
+    virtual color Li(const ray &r, uint64_t &rays) const = 0;
+
+protected:
+    const hittable &world;
+    shared_ptr<hittable> lights;
+    color background;
+    integrator_options opts;
+};
+
+// 原先 main.cpp 中的递归实现, 在 max_depth 处硬截断
+class recursive_integrator : public integrator {
+public:
+    using integrator::integrator;
+
+    virtual color Li(const ray &r, uint64_t &rays) const override {
+        return ray_color(r, opts.max_depth, rays);
+    }
+
+private:
+    color ray_color(const ray &r, int depth, uint64_t &rays) const;
+};
+
+color recursive_integrator::ray_color(const ray &r, int depth,
+                                      uint64_t &rays) const {
+    hit_record rec;
+
+    // If we've exceeded the ray bounce limit, no more light is gathered.
+    if (depth <= 0)
+        return color(0, 0, 0);
+
+    // If the ray hits nothing, return the background color.
+    rays++;
+    if (!world.hit(r, 0.001, FLT_MAX, rec))
+        return background;
+
+    scatter_record srec;
+    color emitted = rec.mat_ptr->emitted(r, rec, rec.u, rec.v, rec.p);
+
+    if (!rec.mat_ptr->scatter(r, rec, srec))
+        return emitted;
+
+    if (srec.is_specular)
+        return srec.attenuation *
+               ray_color(srec.specular_ray, depth - 1, rays);
+
+    auto light_ptr = make_shared<hittable_pdf>(lights, rec.p);
+    mixture_pdf p(light_ptr, srec.pdf_ptr);
+    ray scattered = ray(rec.p, p.generate(), r.time());
+    auto pdf_val = p.value(scattered.direction());
+
+    return emitted +
+           srec.attenuation * rec.mat_ptr->scattering_pdf(r, rec, scattered) *
+               ray_color(scattered, depth - 1, rays) / pdf_val;
+}
+
+// 迭代路径追踪: 在循环中携带路径通量 beta,
+// rr_min_depth 之后按通量做俄罗斯轮盘, 首次漫反射处可分裂为多条子路径
+class path_integrator : public integrator {
+public:
+    using integrator::integrator;
+
+    virtual color Li(const ray &r, uint64_t &rays) const override {
+        return trace(r, color(1, 1, 1), 0, opts.split_count <= 1, rays);
+    }
+
+private:
+    color trace(ray r, color beta, int depth, bool split_done,
+                uint64_t &rays) const;
+};
+
+color path_integrator::trace(ray r, color beta, int depth, bool split_done,
+                             uint64_t &rays) const {
+    color L(0, 0, 0);
+    for (; depth < opts.max_depth; depth++) {
+        hit_record rec;
+        rays++;
+        if (!world.hit(r, 0.001, FLT_MAX, rec)) {
+            L += beta * background;
+            break;
+        }
+
+        scatter_record srec;
+        L += beta * rec.mat_ptr->emitted(r, rec, rec.u, rec.v, rec.p);
+        if (!rec.mat_ptr->scatter(r, rec, srec))
+            break;
+
+        if (srec.is_specular) {
+            beta = beta * srec.attenuation;
+            r = srec.specular_ray;
+        } else {
+            // 等概率混合光源采样与材质采样, 与 mixture_pdf 一致但不在堆上分配
+            int n = split_done ? 1 : opts.split_count;
+            split_done = true;
+            for (int i = 0; i < n; i++) {
+                vec3 direction = (lights && random_double() < 0.5)
+                                     ? lights->random(rec.p)
+                                     : srec.pdf_ptr->generate();
+                ray scattered(rec.p, direction, r.time());
+                double pdf_val = srec.pdf_ptr->value(direction);
+                if (lights)
+                    pdf_val = 0.5 * pdf_val +
+                              0.5 * lights->pdf_value(rec.p, direction);
+                color weight = srec.attenuation *
+                               rec.mat_ptr->scattering_pdf(r, rec, scattered) /
+                               pdf_val;
+                if (n == 1) {
+                    beta = beta * weight;
+                    r = scattered;
+                } else {
+                    L += trace(scattered, beta * weight / n, depth + 1, true,
+                               rays);
+                }
+            }
+            if (n > 1)
+                break;
+        }
+
+        // 俄罗斯轮盘: 通量越低越可能终止, 存活路径按概率补偿保持无偏
+        if (depth + 1 >= opts.rr_min_depth) {
+            double p = fmax(beta.x(), fmax(beta.y(), beta.z()));
+            p = fmin(p, 0.95);
+            if (!(p > 0) || random_double() >= p)
+                break;
+            beta /= p;
+        }
+    }
+    return L;
+}
+
+// 环境光遮蔽: 在相机光线的首个交点处按余弦分布发出遮挡光线,
+// 返回未被遮挡的比例, 只用 occluded 查询
+class ao_integrator : public integrator {
+public:
+    using integrator::integrator;
+
+    virtual color Li(const ray &r, uint64_t &rays) const override;
+};
+
+color ao_integrator::Li(const ray &r, uint64_t &rays) const {
+    hit_record rec;
+    rays++;
+    if (!world.hit(r, 0.001, FLT_MAX, rec))
+        return background;
+
+    // 部分物体的法向不随入射方向翻转, 这里统一朝向光线一侧
+    vec3 n = dot(rec.normal, r.direction()) > 0 ? -rec.normal : rec.normal;
+    onb uvw;
+    uvw.build_from_w(n);
+    int visible = 0;
+    for (int i = 0; i < opts.ao_samples; i++) {
+        ray shadow(rec.p, uvw.local(random_cosine_direction()), r.time());
+        rays++;
+        visible += !world.occluded(shadow, 0.001, opts.ao_distance);
+    }
+    return color(1, 1, 1) * visible / opts.ao_samples;
+}
+
+shared_ptr<integrator> make_integrator(IntegratorType type,
+                                       const hittable &world,
+                                       shared_ptr<hittable> lights,
+                                       const color &background,
+                                       const integrator_options &opts) {
+    if (type == RECURSIVE)
+        return make_shared<recursive_integrator>(world, lights, background,
+                                                 opts);
+    if (type == AO)
+        return make_shared<ao_integrator>(world, lights, background, opts);
+    return make_shared<path_integrator>(world, lights, background, opts);
+}
+
+#endif // RAYTRACE_INTEGRATOR_HPP
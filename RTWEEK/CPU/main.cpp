@@ -2,8 +2,10 @@
 #include "./camera.hpp"
 #include "./customScene.hpp"
 #include "PDF.hpp"
+#include "integrator.hpp"
+#include "progress.hpp"
+#include "scheduler.hpp"
 
-#include "ncurses.h"
 #include "omp.h"
 #include <cfloat>
 #include <fstream>
@@ -12,43 +14,6 @@
 
 using namespace std;
 
-color ray_color(const ray &r, const color &background, const hittable &world,
-                shared_ptr<hittable> lights, int depth) {
-    hit_record rec;
-
-    // If we've exceeded the ray bounce limit, no more light is gathered.
-    if (depth <= 0)
-        return color(0, 0, 0);
-
-    // If the ray hits nothing, return the background color.
-    if (!world.hit(r, 0.001, FLT_MAX, rec)) {
-        return background;
-        vec3 unit_direction = unit_vector(r.direction());
-        auto t = 0.5 * (unit_direction.y() + 1.0);
-        return (1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0);
-    }
-
-    scatter_record srec;
-    color emitted = rec.mat_ptr->emitted(r, rec, rec.u, rec.v, rec.p);
-
-    if (!rec.mat_ptr->scatter(r, rec, srec))
-        return emitted;
-
-    if (srec.is_specular)
-        return srec.attenuation * ray_color(srec.specular_ray, background,
-                                            world, lights, depth - 1);
-
-    auto light_ptr = make_shared<hittable_pdf>(lights, rec.p);
-    mixture_pdf p(light_ptr, srec.pdf_ptr);
-    ray scattered = ray(rec.p, p.generate(), r.time());
-    auto pdf_val = p.value(scattered.direction());
-
-    return emitted +
-           srec.attenuation * rec.mat_ptr->scattering_pdf(r, rec, scattered) *
-               ray_color(scattered, background, world, lights, depth - 1) /
-               pdf_val;
-}
-
 void write_color(vector<vector<int>> &out, color pixel_color, int position,
                  int SPP) {
     auto r = pixel_color.x();
@@ -78,13 +43,6 @@ void write_color(vector<vector<int>> &out, color pixel_color, int position,
 }
 
 int main() {
-    // Log screen
-    initscr();                         //初始化
-    box(stdscr, ACS_VLINE, ACS_HLINE); //画边框
-    curs_set(FALSE);                   /* 不显示光标 */
-    //
-    static omp_lock_t omp_lock;
-    omp_init_lock(&omp_lock);
     double start = omp_get_wtime(); //获取起始时间
     int numProcs = omp_get_max_threads();
     // Image
@@ -93,6 +51,12 @@ int main() {
     const int Image_Height = static_cast<int>(Image_Width / aspect_ratio);
     const int SPP = 30;
     const int max_depth = 5;
+    const IntegratorType Integrator_Type = PATH;
+    const int RR_Min_Depth = 3; // PATH 积分器从该深度开始俄罗斯轮盘
+    const int Split_Count = 1;  // PATH 积分器首次漫反射处的分裂数
+    const int AO_Samples = 16;  // AO 积分器每个交点的遮挡光线数
+    const int Tile_Size = 16;
+    const ProgressOutput Progress_Mode = PROGRESS_CURSES;
     // World
     auto world = test_cornell_box();
     auto lights = make_shared<hittableList>();
@@ -117,34 +81,41 @@ int main() {
     vector<vector<int>> Image(Image_Height * Image_Width);
     for (int i = 0; i < Image.size(); i++)
         Image[i] = move(vector<int>(3));
+    // Integrator
+    integrator_options opts;
+    opts.max_depth = Integrator_Type == RECURSIVE ? max_depth : 64;
+    opts.rr_min_depth = RR_Min_Depth;
+    opts.split_count = Split_Count;
+    opts.ao_samples = AO_Samples;
+    auto tracer =
+        make_integrator(Integrator_Type, world, lights, background, opts);
     // Render
-    int y;
-    omp_set_dynamic(numProcs);
-    omp_set_num_threads(numProcs);
-#pragma omp parallel for private(y)
-    for (y = Image_Height - 1; y >= 0; --y) {
-        // std::cerr << "\rScanlines remaining: " << y << ' ' << std::flush;
-        for (int x = 0; x < Image_Width; ++x) {
-            color pixel_color(0, 0, 0);
-            for (int s = 0; s < SPP; ++s) {
-                auto u = (x + random_double()) / (Image_Width - 1);
-                auto v = (y + random_double()) / (Image_Height - 1);
-                ray r = cam.get_ray(u, v);
-                pixel_color +=
-                    ray_color(r, background, world, lights, max_depth);
+    ProgressReporter progress(Image_Width * Image_Height, numProcs,
+                              Progress_Mode);
+    progress.start();
+    TileScheduler scheduler(Image_Width, Image_Height, Tile_Size, MORTON,
+                            numProcs);
+    scheduler.render([&](const Tile &tile) {
+        for (int y = tile.y1 - 1; y >= tile.y0; --y) {
+            for (int x = tile.x0; x < tile.x1; ++x) {
+                color pixel_color(0, 0, 0);
+                uint64_t rays = 0;
+                for (int s = 0; s < SPP; ++s) {
+                    thread_sampler().start(y * Image_Width + x, s);
+                    auto u = (x + random_double()) / (Image_Width - 1);
+                    auto v = (y + random_double()) / (Image_Height - 1);
+                    ray r = cam.get_ray(u, v);
+                    pixel_color += tracer->Li(r, rays);
+                }
+                write_color(Image, pixel_color, y * Image_Width + x, SPP);
+                progress.add(omp_get_thread_num(), 1, rays);
             }
-            write_color(Image, pixel_color, y * Image_Width + x, SPP);
-            // ouput info
-            omp_set_lock(&omp_lock);
-            move(omp_get_thread_num() + 1, 2);
-            printw("Thread%d:Pixel(%04d, %04d)\t\0", omp_get_thread_num(), x,
-                   y);
-            refresh();
-            omp_unset_lock(&omp_lock);
         }
-    }
-    endwin();
+    });
+    progress.stop();
     printf("calculation done!\n");
+    scheduler.report(stdout);
+    scheduler.dump_timings("tiles.csv");
     ofstream os("test.png");
     os << "P3\n" << Image_Width << " " << Image_Height << "\n255\n";
 
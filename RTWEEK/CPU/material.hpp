@@ -141,7 +141,7 @@ public:
             reflect_prob = reflectance(cosine, ir);
         else
             reflect_prob = 1.0;
-        if (get_random() < reflect_prob)
+        if (random_double() < reflect_prob)
             srec.specular_ray = ray(rec.p, reflected, r_in.time());
         else
             srec.specular_ray = ray(rec.p, refracted, r_in.time());
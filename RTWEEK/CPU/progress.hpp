@@ -0,0 +1,151 @@
+#ifndef RAYTRACE_PROGRESS_HPP
+#define RAYTRACE_PROGRESS_HPP
+
+#include "ncurses.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+// 进度输出方式
+enum ProgressOutput { PROGRESS_CURSES, PROGRESS_STDERR, PROGRESS_JSON };
+
+// 无锁进度统计
+// 工作线程只累加自己独占缓存行的计数器, 由单独的汇报线程按固定频率采样输出,
+// 渲染热路径上没有锁和终端 I/O
+class ProgressReporter {
+public:
+    ProgressReporter(uint64_t total_pixels, int num_threads,
+                     ProgressOutput mode = PROGRESS_CURSES,
+                     int interval_ms = 100)
+        : total_pixels(total_pixels), num_threads(max(num_threads, 1)),
+          mode(mode), interval_ms(interval_ms),
+          counters(new Counter[max(num_threads, 1)]) {}
+    ~ProgressReporter() { stop(); }
+
+    // 由线程 tid 调用, 每个计数器只有一个写者, 不需要原子读-改-写
+    inline void add(int tid, uint64_t pixels, uint64_t rays) {
+        Counter &c = counters[tid];
+        c.pixels.store(c.pixels.load(memory_order_relaxed) + pixels,
+                       memory_order_relaxed);
+        c.rays.store(c.rays.load(memory_order_relaxed) + rays,
+                     memory_order_relaxed);
+    }
+
+    void start();
+    void stop();
+
+private:
+    struct alignas(64) Counter {
+        atomic<uint64_t> pixels{0};
+        atomic<uint64_t> rays{0};
+    };
+
+    void run();
+    void sample(bool final);
+
+    uint64_t total_pixels;
+    int num_threads;
+    ProgressOutput mode;
+    int interval_ms;
+    unique_ptr<Counter[]> counters;
+
+    thread reporter;
+    mutex mtx;
+    condition_variable cv;
+    bool running = false;
+    chrono::steady_clock::time_point start_time;
+};
+
+void ProgressReporter::start() {
+    if (running)
+        return;
+    running = true;
+    start_time = chrono::steady_clock::now();
+    if (mode == PROGRESS_CURSES) {
+        initscr();                         //初始化
+        box(stdscr, ACS_VLINE, ACS_HLINE); //画边框
+        curs_set(FALSE);                   /* 不显示光标 */
+    }
+    reporter = thread(&ProgressReporter::run, this);
+}
+
+void ProgressReporter::stop() {
+    {
+        lock_guard<mutex> guard(mtx);
+        if (!running)
+            return;
+        running = false;
+    }
+    cv.notify_all();
+    reporter.join();
+    sample(true);
+    if (mode == PROGRESS_CURSES)
+        endwin();
+    else if (mode == PROGRESS_STDERR)
+        fprintf(stderr, "\n");
+}
+
+void ProgressReporter::run() {
+    unique_lock<mutex> lock(mtx);
+    while (running) {
+        cv.wait_for(lock, chrono::milliseconds(interval_ms));
+        if (!running)
+            break;
+        lock.unlock();
+        sample(false);
+        lock.lock();
+    }
+}
+
+void ProgressReporter::sample(bool final) {
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() -
+                                              start_time)
+                         .count();
+    uint64_t pixels = 0, rays = 0;
+    for (int i = 0; i < num_threads; i++) {
+        pixels += counters[i].pixels.load(memory_order_relaxed);
+        rays += counters[i].rays.load(memory_order_relaxed);
+    }
+    double progress = total_pixels ? (double)pixels / total_pixels : 1.0;
+    double rays_per_sec = elapsed > 0 ? rays / elapsed : 0.0;
+    double eta = progress > 0 ? elapsed * (1.0 - progress) / progress : -1.0;
+
+    switch (mode) {
+    case PROGRESS_CURSES:
+        for (int i = 0; i < num_threads; i++) {
+            move(i + 1, 2);
+            printw("Thread%d:%8llu pixels", i,
+                   (unsigned long long)counters[i].pixels.load(
+                       memory_order_relaxed));
+        }
+        move(num_threads + 2, 2);
+        printw("%6.2lf%%  %8.3lf Mrays/s  ETA %7.1lfs", progress * 100,
+               rays_per_sec * 1e-6, eta);
+        refresh();
+        break;
+    case PROGRESS_STDERR:
+        fprintf(stderr, "\r%6.2lf%%  %8.3lf Mrays/s  ETA %7.1lfs",
+                progress * 100, rays_per_sec * 1e-6, eta);
+        fflush(stderr);
+        break;
+    case PROGRESS_JSON:
+        fprintf(stderr,
+                "{\"elapsed\":%.3lf,\"pixels\":%llu,\"total\":%llu,"
+                "\"rays\":%llu,\"rays_per_sec\":%.1lf,\"eta\":%.3lf,"
+                "\"done\":%s}\n",
+                elapsed, (unsigned long long)pixels,
+                (unsigned long long)total_pixels, (unsigned long long)rays,
+                rays_per_sec, eta, final ? "true" : "false");
+        fflush(stderr);
+        break;
+    }
+}
+
+#endif // RAYTRACE_PROGRESS_HPP
@@ -6,6 +6,7 @@
 #define RAYTRACE_RAY_HPP
 
 #include "./vec3.hpp"
+#include <cmath>
 
 class ray {
 public:
@@ -21,4 +22,30 @@ public:
     double tm;
 };
 
+// 遍历加速结构用的光线
+// 倒数方向、各轴符号和 float 起点每条光线只算一次,
+// 之后每个 slab 平面按 t = (b - org) * inv 求交, 避免乘加的抵消误差
+class traversal_ray {
+public:
+    explicit traversal_ray(const ray &r) {
+        for (int a = 0; a < 3; a++) {
+            // 方向分量为 0 时 inv 为无穷大, slab 测试会出现 inf - inf;
+            // 夹到极小值后 inv 有限, 起点恰在平面上时得到 t = 0
+            float d = (float)r.direction()[a];
+            if (fabsf(d) < 1e-20f)
+                d = copysignf(1e-20f, d);
+            inv[a] = 1.0f / d;
+            org[a] = (float)r.origin()[a];
+            neg[a] = inv[a] < 0;
+            // 包围盒按 {min xyz, max xyz} 平铺时近/远平面的下标
+            near[a] = neg[a] * 3 + a;
+            far[a] = (1 - neg[a]) * 3 + a;
+        }
+    }
+
+    float inv[3], org[3];
+    int neg[3];
+    int near[3], far[3];
+};
+
 #endif // RAYTRACE_RAY_HPP
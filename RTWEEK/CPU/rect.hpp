@@ -15,33 +15,16 @@ public:
         : a0(_a0), a1(_a1), b0(_b0), b1(_b1), k(_k), mp(mat){};
     virtual bool hit(const ray &r, float t0, float t1,
                      hit_record &rec) const override {
-        double origin_x = r.origin().x(), origin_y = r.origin().y(),
-               origin_z = r.origin().z();
-        double direct_x = r.direction().x(), direct_y = r.direction().y(),
-               direct_z = r.direction().z();
         double t, a, b;
+        if (!intersect(r, t0, t1, t, a, b))
+            return false;
         vec3 outward_normal;
-        if constexpr (N == XY) {
-            t = (k - origin_z) / direct_z;
-            a = origin_x + t * direct_x;
-            b = origin_y + t * direct_y;
+        if constexpr (N == XY)
             outward_normal = vec3(0, 0, 1);
-        } else if constexpr (N == XZ) {
-            t = (k - origin_y) / direct_y;
-            a = origin_x + t * direct_x;
-            b = origin_z + t * direct_z;
+        else if constexpr (N == XZ)
             outward_normal = vec3(0, 1, 0);
-        } else {
-            t = (k - origin_x) / direct_x;
-            a = origin_y + t * direct_y;
-            b = origin_z + t * direct_z;
+        else
             outward_normal = vec3(1, 0, 0);
-        }
-
-        if (t < t0 || t > t1)
-            return false;
-        if (a < a0 || a > a1 || b < b0 || b > b1)
-            return false;
         rec.u = (a - a0) / (a1 - a0);
         rec.v = (b - b0) / (b1 - b0);
         rec.t = t;
@@ -51,6 +34,22 @@ public:
         return true;
     };
 
+    virtual bool occluded(const ray &r, float t0,
+                          float t1) const override {
+        double t, a, b;
+        return intersect(r, t0, t1, t, a, b);
+    }
+
+    virtual void all_hits(const ray &r, float t0, float t1,
+                          hit_collector &out) const override {
+        double t, a, b;
+        if (!intersect(r, t0, t1, t, a, b))
+            return;
+        // 外法向为坐标轴正方向, 方向分量为负即从正面射入
+        constexpr int axis = N == XY ? 2 : N == XZ ? 1 : 0;
+        out.add(t, this, r.direction()[axis] < 0);
+    }
+
     virtual bool bounding_box(float t0, float t1,
                               AABB &output_box) const override {
         if constexpr (N == XY)
@@ -67,13 +66,14 @@ public:
     virtual double pdf_value(const point3 &origin,
                              const vec3 &v) const override {
         if constexpr (N == XZ) {
-            hit_record rec;
-            if (!this->hit(ray(origin, v), 0.001, FLT_MAX, rec))
+            double t, a, b;
+            if (!intersect(ray(origin, v), 0.001, FLT_MAX, t, a, b))
                 return 0;
 
+            // 法向沿 y 轴, 余弦只需方向的 y 分量
             auto area = (a1 - a0) * (b1 - b0);
-            auto distance_squared = rec.t * rec.t * v.length_squared();
-            auto cosine = fabs(dot(v, rec.normal) / v.length());
+            auto distance_squared = t * t * v.length_squared();
+            auto cosine = fabs(v.y() / v.length());
 
             return distance_squared / (cosine * area);
         } else
@@ -92,6 +92,35 @@ public:
 public:
     shared_ptr<material> mp;
     double a0, a1, b0, b1, k;
+
+private:
+    // 光线与矩形所在平面求交, t 在 [t0, t1] 内且交点 (a, b) 落在矩形内
+    bool intersect(const ray &r, double t0, double t1, double &t, double &a,
+                   double &b) const {
+        double origin_x = r.origin().x(), origin_y = r.origin().y(),
+               origin_z = r.origin().z();
+        double direct_x = r.direction().x(), direct_y = r.direction().y(),
+               direct_z = r.direction().z();
+        if constexpr (N == XY) {
+            t = (k - origin_z) / direct_z;
+            a = origin_x + t * direct_x;
+            b = origin_y + t * direct_y;
+        } else if constexpr (N == XZ) {
+            t = (k - origin_y) / direct_y;
+            a = origin_x + t * direct_x;
+            b = origin_z + t * direct_z;
+        } else {
+            t = (k - origin_x) / direct_x;
+            a = origin_y + t * direct_y;
+            b = origin_z + t * direct_z;
+        }
+
+        if (t < t0 || t > t1)
+            return false;
+        if (a < a0 || a > a1 || b < b0 || b > b1)
+            return false;
+        return true;
+    }
 };
 
 #endif // RAYTRACE_RECT_HPP
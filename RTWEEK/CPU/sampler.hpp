@@ -0,0 +1,44 @@
+#ifndef RAYTRACE_SAMPLER_HPP
+#define RAYTRACE_SAMPLER_HPP
+
+#include <cstdint>
+
+// SplitMix64 的终结混合函数, 对相邻输入也能给出充分打散的输出
+inline uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// 基于计数器的随机数流
+// 第 dim 个随机数只由 (像素, 样本, dim) 决定, 与线程数和调度顺序无关,
+// 因此任意线程数下渲染结果逐位相同
+class sampler {
+public:
+    sampler() = default;
+
+    // 开始一个新的像素样本, 维度计数器归零
+    void start(uint64_t pixel, uint64_t sample, uint64_t seed = 0) {
+        key = mix64(mix64(pixel + mix64(seed)) ^ sample);
+        dim = 0;
+    }
+
+    // 下一个维度的 64 位随机数
+    inline uint64_t next() {
+        return mix64(key + (++dim) * 0x9e3779b97f4a7c15ULL);
+    }
+
+    // [0,1) 上的均匀分布, 取高 53 位保证不会得到 1
+    inline double next_1d() { return (next() >> 11) * 0x1.0p-53; }
+
+    uint64_t key = 0;
+    uint64_t dim = 0;
+};
+
+// 每个线程一个随机数流, random_double() 等全部从这里取值
+inline sampler &thread_sampler() {
+    static thread_local sampler s;
+    return s;
+}
+
+#endif // RAYTRACE_SAMPLER_HPP
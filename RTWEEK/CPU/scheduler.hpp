@@ -0,0 +1,211 @@
+#ifndef RAYTRACE_SCHEDULER_HPP
+#define RAYTRACE_SCHEDULER_HPP
+
+#include "omp.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+// 图块遍历顺序
+enum TileOrder { MORTON, SPIRAL, SCANLINE };
+
+// 图像中的一个矩形图块 [x0, x1) x [y0, y1)
+struct Tile {
+    int x0, y0, x1, y1;
+    int thread = -1; // 实际渲染该图块的线程
+    bool stolen = false;
+    double ms = 0.0; // 渲染耗时 (毫秒)
+};
+
+// 把 16 位整数的各位间隔展开, 用于 Morton 编码
+inline uint32_t part1by1(uint32_t x) {
+    x &= 0x0000ffff;
+    x = (x | (x << 8)) & 0x00ff00ff;
+    x = (x | (x << 4)) & 0x0f0f0f0f;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+    return x;
+}
+
+inline uint32_t morton2D(uint32_t x, uint32_t y) {
+    return (part1by1(y) << 1) | part1by1(x);
+}
+
+// 基于图块的工作窃取调度器
+// 图块按 Morton/螺旋顺序排好后连续地分给各线程, 线程先处理自己队列的队首,
+// 空闲时从其他线程队列的队尾窃取, 这样既保持局部性又避免负载不均
+class TileScheduler {
+public:
+    TileScheduler(int width, int height, int tile_size = 16,
+                  TileOrder order = MORTON,
+                  int num_threads = omp_get_max_threads());
+
+    // shade(tile) 对图块内所有像素着色, 不同图块可被并发调用
+    template <typename F> void render(F &&shade);
+
+    const vector<Tile> &tiles() const { return tile_list; }
+    int threads() const { return num_threads; }
+    double elapsed() const { return wall_time; }
+
+    // 输出图块耗时统计
+    void report(FILE *out = stderr) const;
+    // 输出每个图块的耗时 (CSV)
+    bool dump_timings(const char *path) const;
+
+private:
+    // 每个线程的工作队列, 按缓存行对齐避免伪共享
+    struct alignas(64) WorkQueue {
+        mutex mtx;
+        deque<int> tiles;
+    };
+
+    bool pop_local(int tid, int &tile);
+    bool steal(int tid, int &tile);
+
+    int width, height, tile_size, num_threads;
+    double wall_time = 0.0;
+    vector<Tile> tile_list;
+    vector<int> tile_order; // 按遍历顺序排列的图块下标
+    vector<WorkQueue> queues;
+};
+
+TileScheduler::TileScheduler(int width, int height, int tile_size,
+                             TileOrder order, int num_threads)
+    : width(width), height(height), tile_size(max(tile_size, 1)),
+      num_threads(max(num_threads, 1)), queues(max(num_threads, 1)) {
+    int nx = (width + this->tile_size - 1) / this->tile_size;
+    int ny = (height + this->tile_size - 1) / this->tile_size;
+    for (int ty = 0; ty < ny; ty++)
+        for (int tx = 0; tx < nx; tx++) {
+            Tile t;
+            t.x0 = tx * this->tile_size;
+            t.y0 = ty * this->tile_size;
+            t.x1 = min(t.x0 + this->tile_size, width);
+            t.y1 = min(t.y0 + this->tile_size, height);
+            tile_list.push_back(t);
+        }
+
+    tile_order.resize(tile_list.size());
+    for (size_t i = 0; i < tile_order.size(); i++)
+        tile_order[i] = i;
+
+    if (order == MORTON) {
+        stable_sort(tile_order.begin(), tile_order.end(), [&](int a, int b) {
+            return morton2D(a % nx, a / nx) < morton2D(b % nx, b / nx);
+        });
+    } else if (order == SPIRAL) {
+        // 由图像中心向外, 按到中心的环数 (切比雪夫距离) 和角度排序
+        double cx = (nx - 1) / 2.0, cy = (ny - 1) / 2.0;
+        auto ring = [&](int i) {
+            return max(fabs(i % nx - cx), fabs(i / nx - cy));
+        };
+        auto angle = [&](int i) { return atan2(i / nx - cy, i % nx - cx); };
+        stable_sort(tile_order.begin(), tile_order.end(), [&](int a, int b) {
+            double ra = ring(a), rb = ring(b);
+            return ra != rb ? ra < rb : angle(a) < angle(b);
+        });
+    }
+}
+
+bool TileScheduler::pop_local(int tid, int &tile) {
+    lock_guard<mutex> guard(queues[tid].mtx);
+    if (queues[tid].tiles.empty())
+        return false;
+    tile = queues[tid].tiles.front();
+    queues[tid].tiles.pop_front();
+    return true;
+}
+
+bool TileScheduler::steal(int tid, int &tile) {
+    for (int i = 1; i < num_threads; i++) {
+        WorkQueue &victim = queues[(tid + i) % num_threads];
+        lock_guard<mutex> guard(victim.mtx);
+        if (victim.tiles.empty())
+            continue;
+        // 从队尾窃取, 与被窃线程的访问位置相距最远
+        tile = victim.tiles.back();
+        victim.tiles.pop_back();
+        return true;
+    }
+    return false;
+}
+
+template <typename F> void TileScheduler::render(F &&shade) {
+    // 按遍历顺序把连续的一段图块分给每个线程
+    int n = tile_order.size();
+    for (int t = 0; t < num_threads; t++) {
+        queues[t].tiles.clear();
+        int begin = (long long)n * t / num_threads;
+        int end = (long long)n * (t + 1) / num_threads;
+        for (int i = begin; i < end; i++)
+            queues[t].tiles.push_back(tile_order[i]);
+    }
+
+    double start = omp_get_wtime();
+#pragma omp parallel num_threads(num_threads)
+    {
+        int tid = omp_get_thread_num();
+        int idx;
+        while (true) {
+            bool stolen = false;
+            if (!pop_local(tid, idx)) {
+                if (!steal(tid, idx))
+                    break; // 不会产生新图块, 所有队列为空即可结束
+                stolen = true;
+            }
+            double t0 = omp_get_wtime();
+            shade(tile_list[idx]);
+            Tile &tile = tile_list[idx];
+            tile.ms = (omp_get_wtime() - t0) * 1000.0;
+            tile.thread = tid;
+            tile.stolen = stolen;
+        }
+    }
+    wall_time = omp_get_wtime() - start;
+}
+
+void TileScheduler::report(FILE *out) const {
+    if (tile_list.empty())
+        return;
+    double sum = 0.0, lo = DBL_MAX, hi = 0.0;
+    int stolen = 0;
+    vector<double> busy(num_threads, 0.0);
+    for (const auto &t : tile_list) {
+        sum += t.ms;
+        lo = min(lo, t.ms);
+        hi = max(hi, t.ms);
+        stolen += t.stolen;
+        if (t.thread >= 0)
+            busy[t.thread] += t.ms;
+    }
+    fprintf(out,
+            "tiles: %zu (%dx%d px), threads: %d, wall: %.3lfs\n"
+            "tile time (ms): min %.3lf / avg %.3lf / max %.3lf, stolen: %d\n",
+            tile_list.size(), tile_size, tile_size, num_threads, wall_time,
+            lo, sum / tile_list.size(), hi, stolen);
+    double busiest = *max_element(busy.begin(), busy.end());
+    if (busiest > 0)
+        fprintf(out, "thread balance (avg busy / max busy): %.3lf\n",
+                sum / num_threads / busiest);
+}
+
+bool TileScheduler::dump_timings(const char *path) const {
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return false;
+    fprintf(f, "x0,y0,x1,y1,thread,stolen,ms\n");
+    for (const auto &t : tile_list)
+        fprintf(f, "%d,%d,%d,%d,%d,%d,%.4lf\n", t.x0, t.y0, t.x1, t.y1,
+                t.thread, t.stolen, t.ms);
+    fclose(f);
+    return true;
+}
+
+#endif // RAYTRACE_SCHEDULER_HPP
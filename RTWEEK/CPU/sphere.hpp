@@ -19,6 +19,10 @@ public:
         : centre(cen), radius(r), mat_ptr(m){};
     virtual bool hit(const ray &r, float t_min, float t_max,
                      hit_record &rec) const override;
+    virtual bool occluded(const ray &r, float t_min,
+                          float t_max) const override;
+    virtual void all_hits(const ray &r, float t_min, float t_max,
+                          hit_collector &out) const override;
     bool bounding_box(float t0, float t1, AABB &box) const override;
     virtual double pdf_value(const point3 &o, const vec3 &v) const override;
     virtual vec3 random(const point3 &o) const override;
@@ -42,8 +46,9 @@ void get_sphere_uv(const vec3 &p, float &u, float &v) {
     v = (theta + M_PI / 2) / M_PI;
 }
 
-bool sphere::hit(const ray &r, float t_min, float t_max,
-                 hit_record &rec) const {
+// 求光线与球的两个根 (近根在前), 不相交时返回 false
+inline bool sphere_roots(const ray &r, const vec3 &centre, float radius,
+                         float roots[2]) {
     vec3 oc = r.origin() - centre;
     float a = dot(r.direction(), r.direction());
     float b = dot(oc, r.direction());
@@ -53,13 +58,54 @@ bool sphere::hit(const ray &r, float t_min, float t_max,
         return false;
 
     float sqrt_delta = FAST_SQRT(discriminant);
+    roots[0] = (-b - sqrt_delta) / a;
+    roots[1] = (-b + sqrt_delta) / a;
+    return true;
+}
+
+inline bool sphere_root_valid(float t, float t_min, float t_max) {
+    return !(t > t_max || t < t_min || fabs(t) < 0.0005f);
+}
 
-    float tmp = (-b - sqrt_delta) / a;
-    if (tmp > t_max || tmp < t_min || fabs(tmp) < 0.0005f) {
-        tmp = (-b + sqrt_delta) / a;
-        if (tmp > t_max || tmp < t_min || fabs(tmp) < 0.0005f)
-            return false;
+// 返回 [t_min, t_max] 内最近的根, 没有时返回 false
+inline bool sphere_root(const ray &r, const vec3 &centre, float radius,
+                        float t_min, float t_max, float &t) {
+    float roots[2];
+    if (!sphere_roots(r, centre, radius, roots))
+        return false;
+    for (int i = 0; i < 2; i++)
+        if (sphere_root_valid(roots[i], t_min, t_max)) {
+            t = roots[i];
+            return true;
+        }
+    return false;
+}
+
+bool sphere::occluded(const ray &r, float t_min, float t_max) const {
+    float t;
+    return sphere_root(r, centre, radius, t_min, t_max, t);
+}
+
+// 两个根都在区间内时都加入, 近根为入射面 (起点在球外时)
+void sphere::all_hits(const ray &r, float t_min, float t_max,
+                      hit_collector &out) const {
+    float roots[2];
+    if (!sphere_roots(r, centre, radius, roots))
+        return;
+    for (int i = 0; i < 2; i++) {
+        float t = roots[i];
+        if (!sphere_root_valid(t, t_min, t_max))
+            continue;
+        vec3 outward = r.point_at(t) - centre;
+        out.add(t, this, dot(r.direction(), outward) < 0);
     }
+}
+
+bool sphere::hit(const ray &r, float t_min, float t_max,
+                 hit_record &rec) const {
+    float tmp;
+    if (!sphere_root(r, centre, radius, t_min, t_max, tmp))
+        return false;
     rec.t = tmp;
     rec.p = r.point_at(rec.t);
     rec.normal = (rec.p - centre) / radius;
@@ -69,8 +115,7 @@ bool sphere::hit(const ray &r, float t_min, float t_max,
 }
 
 double sphere::pdf_value(const point3 &o, const vec3 &v) const {
-    hit_record rec;
-    if (!this->hit(ray(o, v), 0.001, FLT_MAX, rec))
+    if (!occluded(ray(o, v), 0.001, FLT_MAX))
         return 0;
 
     auto cos_theta_max =